@@ -0,0 +1,111 @@
+// Micro-benchmark: perfect-hash vs linear-scan keyword classification.
+//
+// usage: bench_keywords [FILE]
+//
+// Without FILE an identifier-heavy gate-level netlist is synthesized in
+// memory. Every identifier and keyword token in the input is classified
+// with both lookup_keyword() and lookup_keyword_linear().
+
+#define STB_DS_IMPLEMENTATION
+#include "alloc.h"
+#include "stb_ds.h"
+#include "common.h"
+#include "symtab.h"
+#include "literal.h"
+#include "tokenizer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_CELLS   200000
+#define NUM_PASSES  20
+
+static const char * cell_types[] = {
+    "NAND2X1", "NOR2X1", "INVX2", "AOI21X1", "OAI22X1", "DFFRX1", "MUX2X1", "XOR2X1",
+};
+
+static Buffer
+gen_netlist()
+{
+    Buffer buffer = {0};
+    char line[256];
+    srand(1);
+
+#define APPEND(...) do { \
+        int n = snprintf(line, sizeof(line), __VA_ARGS__); \
+        memcpy(arraddnptr(buffer.p, n), line, n); \
+    } while (0)
+
+    APPEND("module top(\n    input clk,\n    output out\n);\n");
+    for (int i = 0; i < NUM_CELLS/4; i++)
+        APPEND("    wire u_core_dp_n%d;\n", i);
+    for (int i = 0; i < NUM_CELLS; i++) {
+        const char * cell = cell_types[rand() % NELEMS(cell_types)];
+        int a = rand() % (NUM_CELLS/4), b = rand() % (NUM_CELLS/4), y = rand() % (NUM_CELLS/4);
+        APPEND("    %s u_core_dp_U%d(.A(u_core_dp_n%d), .B(u_core_dp_n%d), .Y(u_core_dp_n%d));\n",
+               cell, i, a, b, y);
+    }
+    APPEND("endmodule\n");
+#undef APPEND
+
+    buffer.len = arrlenu(buffer.p);
+    memset(arraddnptr(buffer.p, BUFFER_PADDING), 0, BUFFER_PADDING);
+    buffer.cap = arrlenu(buffer.p);
+    return buffer;
+}
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static double
+time_lookup(const TokenList * tl, const size_t * idents, TokenType (*lookup)(const char *, size_t), size_t * sum)
+{
+    double start = now();
+    for (int pass = 0; pass < NUM_PASSES; pass++) {
+        for (size_t i = 0; i < arrlenu(idents); i++) {
+            Token tok = token_at(tl, idents[i]);
+            *sum += lookup(tok.str, tok.len);
+        }
+    }
+    return now() - start;
+}
+
+int main(int argc, char * argv[])
+{
+    Buffer input = argc > 1 ? read_file(argv[1]) : gen_netlist();
+    SymbolTable symtab = {0};
+    TokenList tl = tokenize(input, &symtab);
+
+    size_t * idents = NULL;
+    size_t num_keywords = 0;
+    for (size_t i = 0; i < num_tokens(&tl); i++) {
+        TokenType type = tl.types[i];
+        if (type == TOK_IDENT || (type >= TOK_MODULE && type <= TOK_OUTPUT) ||
+            type == TOK_POSEDGE || type == TOK_NEGEDGE || type == TOK_OR) {
+            arrput(idents, i);
+            num_keywords += type != TOK_IDENT;
+        }
+    }
+    size_t n = arrlenu(idents) * NUM_PASSES;
+
+    size_t sum_linear = 0, sum_hash = 0;
+    double t_linear = time_lookup(&tl, idents, lookup_keyword_linear, &sum_linear);
+    double t_hash   = time_lookup(&tl, idents, lookup_keyword, &sum_hash);
+    if (sum_linear != sum_hash)
+        die("error: lookup_keyword and lookup_keyword_linear disagree\n");
+
+    printf("%zu identifiers (%zu keywords), %d passes\n", arrlenu(idents), num_keywords, NUM_PASSES);
+    printf("linear: %8.2f ns/ident\n", t_linear*1e9/n);
+    printf("hash:   %8.2f ns/ident  (%.2fx)\n", t_hash*1e9/n, t_linear/t_hash);
+
+    arrfree(idents);
+    free_tokens(&tl);
+    free_symtab(&symtab);
+    return 0;
+}
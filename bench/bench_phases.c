@@ -0,0 +1,628 @@
+// Throughput of each phase on synthetic designs.
+//
+// usage: bench_phases [-s SEED] [-n SCALE] [-r REPS]
+//        bench_phases --gen CORPUS [-s SEED] [-n SCALE] > FILE.v
+//
+// Four corpora are generated in memory from SEED, at SCALE times their
+// default size:
+//
+//     hierarchy   a deep tree of small modules with glue logic
+//     netlist     one wide gate-level module
+//     expr        long random expressions
+//     literal     wide sized literals with x and z bits
+//
+// Each is lexed (tokenize(), i.e. get_token() and interning), parsed
+// (parse_tokens()) and printed (emit_verilog() to /dev/null) REPS times,
+// and the fastest run of each phase is reported as one JSON object per
+// line on stdout:
+//
+//     {"corpus":"expr","phase":"parse","bytes":...,"tokens":...,
+//      "nodes":...,"seconds":...,"mb_per_s":...,"tokens_per_s":...,
+//      "nodes_per_s":...,"peak_rss_kb":...}
+//
+// Rates are over the whole corpus: its input bytes, its tokens and the
+// nodes of its tree, whichever phase is measured. peak_rss_kb is the
+// process's peak RSS during the phase, where /proc/self/clear_refs can
+// reset it, and the peak so far otherwise. --gen writes a corpus to
+// stdout instead.
+//
+// Before any timing, each corpus and a module of tricky literals and
+// operators are printed and lexed again, and the run fails if any literal
+// changed value. All but the hierarchy are parsed again too, and the run
+// fails if that prints differently.
+// Random edits to the start of each corpus are then reparsed with
+// reparse_edit(), and the run fails if the result differs from a full
+// parse of the edited text.
+
+#define STB_DS_IMPLEMENTATION
+#include "alloc.h"
+#include "stb_ds.h"
+#include "common.h"
+#include "symtab.h"
+#include "literal.h"
+#include "arena.h"
+#include "ast.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "emit.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// splitmix64, so that a seed makes the same corpus with any libc
+static uint64_t rng_state;
+
+static uint64_t
+rng()
+{
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static uint32_t
+below(uint32_t n)
+{
+    return rng() % n;
+}
+
+static void
+put(char ** out, const char * fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    char * p = arraddnptr(*out, n + 1);
+    va_start(ap, fmt);
+    vsnprintf(p, n + 1, fmt, ap);
+    va_end(ap);
+    arrsetlen(*out, arrlenu(*out) - 1);    // drop the NUL
+}
+
+static void
+put_char(char ** out, char c)
+{
+    arrput(*out, c);
+}
+
+static void
+put_bytes(char ** out, const char * p, size_t n)
+{
+    if (n)
+        memcpy(arraddnptr(*out, n), p, n);
+}
+
+static const char * binary_ops[] = {
+    "|", "&", "^", "~^", "&&", "||", "==", "!=", "===", "!==", "<", "<=", ">", ">=",
+    "<<", ">>", "<<<", ">>>", "+", "-", "*", "/", "%", "**",
+};
+
+static const char * unary_ops[] = { "~", "!", "-", "&", "|", "^" };
+
+static void
+gen_literal(char ** out, uint32_t max_width)
+{
+    static const char digits[] = "0123456789abcdef";
+    uint32_t width = 1 + below(max_width);
+    switch (below(3)) {
+        case 0:
+            put(out, "%u'b", width);
+            for (uint32_t i = 0; i < width; i++)
+                put_char(out, "01xz"[below(16) < 14 ? below(2) : 2 + below(2)]);
+            break;
+        case 1:
+            put(out, "%u'h", width);
+            for (uint32_t i = 0; i < (width + 3) / 4; i++)
+                put_char(out, below(64) ? digits[below(16)] : "xz"[below(2)]);
+            break;
+        default:
+            put(out, "%u'd%u", width, below(1000));
+            break;
+    }
+}
+
+// nsignals names s0.. to draw operands from
+static void
+gen_expr(char ** out, int depth, uint32_t nsignals)
+{
+    if (depth == 0 || below(5) == 0) {
+        switch (below(4)) {
+            case 0:     put(out, "s%u[%u]", below(nsignals), below(32)); break;
+            case 1:     gen_literal(out, 16); break;
+            default:    put(out, "s%u", below(nsignals)); break;
+        }
+        return;
+    }
+    switch (below(8)) {
+        case 0:
+            // the space keeps & &x from lexing as &&x
+            put(out, "%s ", unary_ops[below(NELEMS(unary_ops))]);
+            gen_expr(out, depth - 1, nsignals);
+            break;
+        case 1:
+            gen_expr(out, depth - 1, nsignals);
+            put(out, " ? ");
+            gen_expr(out, depth - 1, nsignals);
+            put(out, " : ");
+            gen_expr(out, depth - 1, nsignals);
+            break;
+        case 2:
+            put_char(out, '(');
+            gen_expr(out, depth - 1, nsignals);
+            put_char(out, ')');
+            break;
+        case 3:
+            put(out, "s%u[", below(nsignals));
+            gen_expr(out, depth - 1, nsignals);
+            put_char(out, ']');
+            break;
+        default:
+            gen_expr(out, depth - 1, nsignals);
+            put(out, " %s ", binary_ops[below(NELEMS(binary_ops))]);
+            gen_expr(out, depth - 1, nsignals);
+            break;
+    }
+}
+
+static void
+gen_signals(char ** out, uint32_t nsignals)
+{
+    for (uint32_t i = 0; i < nsignals; i++)
+        put(out, "    wire [31:0] s%u;\n", i);
+}
+
+// LEVELS levels of modules; each one instantiates FANOUT modules of the
+// next level, and the last level is leaves.
+#define LEVELS  12
+#define VARIANTS 1000
+#define FANOUT  3
+
+static void
+gen_hierarchy(char ** out, int scale)
+{
+    for (int level = 0; level < LEVELS; level++) {
+        for (int v = 0; v < VARIANTS * scale; v++) {
+            put(out, "module h%d_%d(\n    input clk,\n    input rst,\n    input [31:0] a,\n    output [31:0] y\n);\n", level, v);
+            gen_signals(out, 8);
+            if (level + 1 < LEVELS) {
+                for (int k = 0; k < FANOUT; k++)
+                    put(out, "    h%d_%u u%d(\n        .clk(clk),\n        .rst(rst),\n        .a(s%d),\n        .y(s%d)\n    );\n",
+                        level + 1, below(VARIANTS * scale), k, k, k + FANOUT);
+            }
+            for (int k = 0; k < 4; k++) {
+                put(out, "    assign s%d = ", k);
+                gen_expr(out, 3, 8);
+                put(out, ";\n");
+            }
+            put(out, "    reg [31:0] r;\n");
+            put(out, "    always @(posedge clk or posedge rst) begin\n        if (a[0])\n            r <= ");
+            gen_expr(out, 3, 8);
+            put(out, ";\n        else\n            r <= s7;\n    end\n");
+            put(out, "    assign y = s%u ^ a;\nendmodule\n\n", below(8));
+        }
+    }
+}
+
+static const char * cell_types[] = {
+    "NAND2X1", "NOR2X1", "AOI21X1", "OAI22X1", "MUX2X1", "XOR2X1", "DFFRX1", "INVX2",
+};
+
+#define NETLIST_CELLS 400000
+
+static void
+gen_netlist(char ** out, int scale)
+{
+    uint32_t ncells = NETLIST_CELLS * scale;
+    uint32_t nnets = ncells / 2;
+    put(out, "module top(\n    input clk,\n    input [63:0] din,\n    output [63:0] dout\n);\n");
+    for (uint32_t i = 0; i < nnets; i++)
+        put(out, "    wire n%u;\n", i);
+    for (uint32_t i = 0; i < ncells; i++) {
+        uint32_t type = below(NELEMS(cell_types));
+        put(out, "    %s U%u(", cell_types[type], i);
+        if (type == NELEMS(cell_types) - 1) {
+            put(out, ".A(n%u), .Y(n%u));\n", below(nnets), below(nnets));
+        } else if (type == NELEMS(cell_types) - 2) {
+            put(out, ".D(n%u), .CK(clk), .RN(1'b1), .Q(dout[%u]));\n", below(nnets), below(64));
+        } else {
+            put(out, ".A(n%u), .B(din[%u]), .C(n%u), .Y(n%u));\n",
+                below(nnets), below(64), below(nnets), below(nnets));
+        }
+    }
+    put(out, "endmodule\n\n");
+}
+
+#define EXPR_MODULES 4000
+
+static void
+gen_exprs(char ** out, int scale)
+{
+    for (int m = 0; m < EXPR_MODULES * scale; m++) {
+        put(out, "module e%d(\n    input clk,\n    output [31:0] y\n);\n", m);
+        gen_signals(out, 16);
+        for (int k = 0; k < 4; k++) {
+            put(out, "    assign s%d = ", k);
+            gen_expr(out, 10 + below(4), 16);
+            put(out, ";\n");
+        }
+        put(out, "    assign y = s0;\nendmodule\n\n");
+    }
+}
+
+#define LITERAL_MODULES 2000
+
+static void
+gen_literals(char ** out, int scale)
+{
+    for (int m = 0; m < LITERAL_MODULES * scale; m++) {
+        put(out, "module l%d(\n    input clk,\n    output [4095:0] y\n);\n", m);
+        put(out, "    reg [4095:0] r;\n    initial begin\n");
+        for (int k = 0; k < 8; k++) {
+            put(out, "        r <= ");
+            gen_literal(out, 4096);
+            put(out, ";\n");
+        }
+        put(out, "    end\n    assign y = ");
+        gen_literal(out, 4096);
+        put(out, " ^ ");
+        gen_literal(out, 64);
+        put(out, ";\nendmodule\n\n");
+    }
+}
+
+typedef struct {
+    const char * name;
+    void (*gen)(char ** out, int scale);
+    bool parses_back;       // printed text parses to the same tree
+} Corpus;
+
+// The hierarchy's sensitivity lists are kept without their signals and
+// print as @(), which does not parse.
+static const Corpus corpora[] = {
+    { "hierarchy",  gen_hierarchy,  false },
+    { "netlist",    gen_netlist,    true },
+    { "expr",       gen_exprs,      true },
+    { "literal",    gen_literals,   true },
+};
+
+static Buffer
+gen_corpus(const Corpus * corpus, uint64_t seed, int scale)
+{
+    rng_state = seed;
+    char * text = NULL;
+    corpus->gen(&text, scale);
+    Buffer buffer = copy_buffer(text, arrlenu(text));
+    arrfree(text);
+    return buffer;
+}
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Resets the peak RSS, so that the next peak_rss_kb() is the phase's own.
+static void
+reset_peak_rss()
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd == -1)
+        return;
+    if (write(fd, "5", 1) != 1) {
+        // an older kernel: the peak stays the process's
+    }
+    close(fd);
+}
+
+static long
+peak_rss_kb()
+{
+    FILE * fp = fopen("/proc/self/status", "r");
+    if (!fp)
+        return -1;
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), fp))
+        if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+            break;
+    fclose(fp);
+    return kb;
+}
+
+typedef struct {
+    double seconds;         // fastest run
+    long peak_rss_kb;       // of that run
+} PhaseResult;
+
+static void
+record(PhaseResult * result, double seconds, int rep)
+{
+    if (rep == 0 || seconds < result->seconds) {
+        result->seconds = seconds;
+        result->peak_rss_kb = peak_rss_kb();
+    }
+}
+
+static bool
+same_literal(const LiteralTable * a, uint32_t i, const LiteralTable * b, uint32_t j)
+{
+    const Literal * x = literal_at(a, i);
+    const Literal * y = literal_at(b, j);
+    if (x->width != y->width || (x->flags & LIT_SIGNED) != (y->flags & LIT_SIGNED))
+        return false;
+    size_t nwords = (x->width + 63) / 64;
+    return !memcmp(literal_aval(a, x), literal_aval(b, y), nwords * sizeof(uint64_t))
+        && !memcmp(literal_bval(a, x), literal_bval(b, y), nwords * sizeof(uint64_t));
+}
+
+// Prints the parsed input and lexes the result again. Every literal must
+// come back with the same width and bits, whatever base it is printed in.
+// If parse_back, the printed text is parsed too and must print the same.
+static void
+check_round_trip(const char * name, Buffer input, bool parse_back)
+{
+    ParseCtx ctx = init_parse_ctx(false, false, false);
+    TokenList tl = tokenize(input, &ctx.symtab);
+    parse_tokens(&ctx, &tl);
+    if (arrlenu(ctx.diags))
+        die("error: %s corpus has %zu syntax errors\n", name, arrlenu(ctx.diags));
+    Emitter e = init_emitter(-1, 1 << 20);
+    emit_verilog(&e, &ctx.ast, &ctx.symtab, NULL);
+    Buffer printed = copy_buffer(e.buf, e.len);
+    free_emitter(&e);
+
+    ParseCtx reparsed = init_parse_ctx(false, false, false);
+    TokenList again = tokenize(printed, &reparsed.symtab);
+    const LiteralTable * before = &ctx.ast.literals;
+    size_t n = arrlenu(before->lits);
+    if (arrlenu(again.literals.lits) != n)
+        die("error: %s corpus: %zu literals printed as %zu\n", name, n, arrlenu(again.literals.lits));
+    for (uint32_t i = 0; i < n; i++) {
+        if (same_literal(before, i, &again.literals, i))
+            continue;
+        char text[64];
+        format_literal(&again.literals, i, text, sizeof(text));
+        die("error: %s corpus: literal %u changed value when printed as %s\n", name, i, text);
+    }
+    if (parse_back) {
+        parse_tokens(&reparsed, &again);
+        e = init_emitter(-1, 1 << 20);
+        emit_verilog(&e, &reparsed.ast, &reparsed.symtab, NULL);
+        if (arrlenu(reparsed.diags) || e.len != printed.len || memcmp(e.buf, printed.p, e.len))
+            die("error: %s corpus: printed text does not parse back to the same tree\n", name);
+        free_emitter(&e);
+    }
+    free_tokens(&again);
+    free_parse_ctx(&reparsed);
+    free_buffer(&printed);
+    free_tokens(&tl);
+    free_parse_ctx(&ctx);
+}
+
+// Prints the tree and errors of ctx, to compare two parses by.
+static char *
+describe_parse(const ParseCtx * ctx)
+{
+    Emitter e = init_emitter(-1, 1 << 16);
+    emit_verilog(&e, (Ast *) &ctx->ast, &ctx->symtab, NULL);
+    char * out = NULL;
+    put_bytes(&out, e.buf, e.len);
+    free_emitter(&e);
+    for (size_t i = 0; i < arrlenu(ctx->diags); i++)
+        put(&out, "error at byte %zu: %s\n", ctx->diags[i].offset, ctx->diags[i].message);
+    for (size_t i = 0; i < arrlenu(ctx->spans); i++)
+        put(&out, "module at %zu-%zu\n", ctx->spans[i].begin, ctx->spans[i].end);
+    return out;
+}
+
+#define EDIT_BYTES  (64 << 10)
+#define EDITS       64
+
+// Makes random edits to the modules in the first EDIT_BYTES of the input,
+// and checks that reparse_edit() after each one gives the same tree,
+// errors and module spans as parsing the edited text from scratch. Most
+// edits keep the text valid; one in four pastes a random slice of it
+// elsewhere, which usually leaves a syntax error for the next edits to
+// be spliced around.
+static void
+check_reparse_edits(const char * name, Buffer input)
+{
+    size_t len = 0;
+    for (const char * p = input.p; (p = strstr(p, "endmodule\n")); p += 10) {
+        if ((size_t) (p + 10 - input.p) > EDIT_BYTES)
+            break;
+        len = p + 10 - input.p;
+    }
+    if (len == 0)
+        return;     // a single large module: nothing to keep across an edit
+    char * text = NULL;
+    put_bytes(&text, input.p, len);
+
+    ParseCtx ctx = init_parse_ctx(false, false, false);
+    Buffer buffer = copy_buffer(text, len);
+    parse_verilog(&ctx, buffer);
+    free_buffer(&buffer);
+    for (int i = 0; i < EDITS; i++) {
+        size_t n = arrlenu(text);
+        size_t begin = below(n), old_end = begin;
+        char * repl = NULL;
+        switch (below(4)) {
+            case 0:
+                while (begin < n && text[begin] != '\n')
+                    begin++;
+                old_end = begin;
+                put(&repl, "\n    // edit %d", i);
+                break;
+            case 1:
+                while (begin < n && (text[begin] < '0' || text[begin] > '9'))
+                    begin++;
+                old_end = begin < n ? begin + 1 : n;
+                put_char(&repl, '0' + below(10));
+                break;
+            case 2:
+                while (begin < n && text[begin] != ';')
+                    begin++;
+                old_end = begin < n ? begin + 1 : n;
+                put(&repl, "; wire w%d;", i);
+                break;
+            default: {
+                old_end = begin + below(32);
+                if (old_end > n)
+                    old_end = n;
+                size_t from = below(n), count = below(32);
+                if (count > n - from)
+                    count = n - from;
+                put_bytes(&repl, text + from, count);
+                break;
+            }
+        }
+        Edit edit = { begin, old_end, begin + arrlenu(repl) };
+        char * edited = NULL;
+        put_bytes(&edited, text, begin);
+        put_bytes(&edited, repl, arrlenu(repl));
+        put_bytes(&edited, text + old_end, n - old_end);
+        arrfree(repl);
+        arrfree(text);
+        text = edited;
+
+        buffer = copy_buffer(text, arrlenu(text));
+        reparse_edit(&ctx, buffer, edit);
+        ParseCtx full = init_parse_ctx(false, false, false);
+        parse_verilog(&full, buffer);
+        free_buffer(&buffer);
+        char * got = describe_parse(&ctx);
+        char * want = describe_parse(&full);
+        if (arrlenu(got) != arrlenu(want) || memcmp(got, want, arrlenu(got)))
+            die("error: %s corpus: edit %d (bytes %zu-%zu now %zu-%zu) reparsed differently from a full parse\n",
+                name, i, edit.begin, edit.old_end, edit.begin, edit.new_end);
+        arrfree(got);
+        arrfree(want);
+        free_parse_ctx(&full);
+    }
+    free_parse_ctx(&ctx);
+    arrfree(text);
+}
+
+// Literals and operators whose printed form is easy to get wrong.
+static const char edge_cases[] =
+    "module edges(\n    input clk,\n    output [7:0] y\n);\n"
+    "    reg [63:0] r;\n    initial begin\n"
+    "        r <= 8'b0000_000x;\n        r <= 'b0z;\n        r <= 12'h0x;\n"
+    "        r <= 'o0z;\n        r <= 8'b0z0x;\n        r <= 70'h0z;\n"
+    "        r <= 8'bx;\n        r <= 'hz;\n        r <= 8'b1;\n"
+    "        r <= 18446744073709551615;\n        #123456789012345678901234567890\n"
+    "        r <= 123456789012345678901234567890;\n"
+    "    end\n    assign y = 'b0;\n"
+    "    assign y = & &r;\n    assign y = ~ &r;\n    assign y = | |r;\n    assign y = ^ ~r;\n"
+    "    assign y = ~^ ^r;\n    assign y = ! !r;\n    assign y = - -r;\n    assign y = - +r;\n"
+    "    assign y = ~ ~|r;\nendmodule\n";
+
+static void
+bench_corpus(const Corpus * corpus, uint64_t seed, int scale, int reps)
+{
+    Buffer input = gen_corpus(corpus, seed, scale);
+    check_round_trip(corpus->name, input, corpus->parses_back);
+    check_reparse_edits(corpus->name, input);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd == -1)
+        die("error: cannot open /dev/null\n");
+
+    PhaseResult results[NUM_PHASES];
+    size_t tokens = 0, nodes = 0, errors = 0;
+    for (int rep = 0; rep < reps; rep++) {
+        ParseCtx ctx = init_parse_ctx(false, false, false);
+
+        reset_peak_rss();
+        double start = now();
+        TokenList tl = tokenize(input, &ctx.symtab);
+        record(&results[PHASE_LEX], now() - start, rep);
+        tokens = num_tokens(&tl);
+
+        reset_peak_rss();
+        start = now();
+        parse_tokens(&ctx, &tl);
+        record(&results[PHASE_PARSE], now() - start, rep);
+        nodes = arrlenu(ctx.ast.nodes);
+        errors = arrlenu(ctx.diags);
+
+        reset_peak_rss();
+        start = now();
+        Emitter e = init_emitter(null_fd, 1 << 20);
+        emit_verilog(&e, &ctx.ast, &ctx.symtab, NULL);
+        free_emitter(&e);
+        record(&results[PHASE_PRINT], now() - start, rep);
+
+        free_tokens(&tl);
+        free_parse_ctx(&ctx);
+    }
+    // a corpus the parser rejects would measure error recovery instead
+    if (errors)
+        die("error: %s corpus has %zu syntax errors\n", corpus->name, errors);
+
+    static const Phase phases[] = { PHASE_LEX, PHASE_PARSE, PHASE_PRINT };
+    for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]); i++) {
+        Phase p = phases[i];
+        double s = results[p].seconds;
+        printf("{\"corpus\":\"%s\",\"phase\":\"%s\",\"bytes\":%zu,\"tokens\":%zu,\"nodes\":%zu,"
+               "\"seconds\":%.6f,\"mb_per_s\":%.2f,\"tokens_per_s\":%.0f,\"nodes_per_s\":%.0f,"
+               "\"peak_rss_kb\":%ld}\n",
+               corpus->name, phase_name(p), input.len, tokens, nodes,
+               s, input.len / s / 1e6, tokens / s, nodes / s, results[p].peak_rss_kb);
+    }
+    fflush(stdout);
+    close(null_fd);
+    free_buffer(&input);
+}
+
+int main(int argc, char * argv[])
+{
+    int seed = 1;
+    int scale = 1;
+    int reps = 3;
+    const char * gen = NULL;
+    for (int i = 1; i < argc; i++) {
+        int * opt = NULL;
+        if (!strcmp(argv[i], "-s") && i + 1 < argc)
+            opt = &seed;
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            opt = &scale;
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            opt = &reps;
+        else if (!strcmp(argv[i], "--gen") && i + 1 < argc)
+            gen = argv[++i];
+        else
+            die("usage: %s [-s SEED] [-n SCALE] [-r REPS] [--gen CORPUS]\n", argv[0]);
+        if (opt) {
+            int err = parse_int(argv[++i], opt);
+            if (err || *opt < 1)
+                die("error: %s %s: %s\n", argv[i - 1], argv[i], err ? parse_int_strerror(err) : "must be at least 1");
+        }
+    }
+
+    if (gen) {
+        for (size_t c = 0; c < NELEMS(corpora); c++) {
+            if (strcmp(gen, corpora[c].name))
+                continue;
+            Buffer input = gen_corpus(&corpora[c], seed, scale);
+            fwrite(input.p, 1, input.len, stdout);
+            free_buffer(&input);
+            return 0;
+        }
+        die("error: no corpus named %s\n", gen);
+    }
+    Buffer edges = copy_buffer(edge_cases, sizeof(edge_cases) - 1);
+    check_round_trip("edge case", edges, true);
+    free_buffer(&edges);
+    for (size_t c = 0; c < NELEMS(corpora); c++)
+        bench_corpus(&corpora[c], seed, scale, reps);
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include "alloc.h"
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+// Shared by every thread, so relaxed atomics: each counter only has to
+// add up, not to agree with the others at any one instant.
+static atomic_size_t allocated;
+static atomic_size_t in_use;
+static atomic_size_t peak;
+
+static void
+count_change(size_t old_size, size_t new_size)
+{
+    if (new_size > old_size)
+        atomic_fetch_add_explicit(&allocated, new_size, memory_order_relaxed);
+    size_t now = atomic_fetch_add_explicit(&in_use, new_size - old_size, memory_order_relaxed)
+               + new_size - old_size;
+    size_t seen = atomic_load_explicit(&peak, memory_order_relaxed);
+    while (now > seen && !atomic_compare_exchange_weak_explicit(&peak, &seen, now,
+                                                                memory_order_relaxed,
+                                                                memory_order_relaxed))
+        ;
+}
+
+// realloc(p, 0) may free p and return NULL, so that is a counted_free().
+void *
+counted_realloc(void * p, size_t size)
+{
+    if (size == 0 && p) {
+        counted_free(p);
+        return NULL;
+    }
+    size_t old_size = p ? malloc_usable_size(p) : 0;
+    void * q = realloc(p, size);
+    if (q)
+        count_change(old_size, malloc_usable_size(q));
+    return q;
+}
+
+void
+counted_free(void * p)
+{
+    if (p)
+        count_change(malloc_usable_size(p), 0);
+    free(p);
+}
+
+AllocStats
+alloc_stats()
+{
+    return (AllocStats) {
+        .allocated = atomic_load_explicit(&allocated, memory_order_relaxed),
+        .in_use = atomic_load_explicit(&in_use, memory_order_relaxed),
+        .peak = atomic_load_explicit(&peak, memory_order_relaxed),
+    };
+}
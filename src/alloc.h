@@ -0,0 +1,24 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+
+// Heap accounting for --stats. Included before stb_ds.h, which then
+// allocates every array through counted_realloc() and counted_free();
+// arena blocks go through them too. Sizes are malloc_usable_size(), so
+// a block counts what it really holds but not the allocator's headers.
+
+typedef struct {
+    size_t allocated;       // every allocation and reallocation, summed
+    size_t in_use;
+    size_t peak;            // high-water mark of in_use
+} AllocStats;
+
+void * counted_realloc(void * p, size_t size);
+void counted_free(void * p);
+AllocStats alloc_stats(void);
+
+#define STBDS_REALLOC(context, p, size) counted_realloc(p, size)
+#define STBDS_FREE(context, p) counted_free(p)
+
+#endif /* ALLOC_H */
@@ -0,0 +1,95 @@
+#include "alloc.h"
+#include "common.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_MIN_BLOCK (64 << 10)
+
+static size_t
+align_up(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+}
+
+static ArenaBlock *
+new_block(Arena * arena, size_t size)
+{
+    size_t cap = arena->block ? 2 * arena->block->cap : ARENA_MIN_BLOCK;
+    if (cap < size)
+        cap = size;
+    ArenaBlock * block = counted_realloc(NULL, sizeof(*block) + cap);
+    if (block == NULL)
+        die("error: out of memory for %zu byte arena block\n", cap);
+    block->prev = arena->block;
+    block->cap = cap;
+    block->used = 0;
+    arena->block = block;
+    return block;
+}
+
+void *
+arena_alloc(Arena * arena, size_t size)
+{
+    size = align_up(size);
+    ArenaBlock * block = arena->block;
+    if (block == NULL || block->cap - block->used < size)
+        block = new_block(arena, size);
+    void * p = block->data + block->used;
+    block->used += size;
+    arena->used += size;
+    if (arena->used > arena->peak)
+        arena->peak = arena->used;
+    return p;
+}
+
+// Like realloc(). The most recent allocation is extended in place when its
+// block has room; anything else is copied and the old bytes stay put
+// until the next reset.
+void *
+arena_grow(Arena * arena, void * p, size_t old_size, size_t new_size)
+{
+    ArenaBlock * block = arena->block;
+    old_size = align_up(old_size);
+    new_size = align_up(new_size);
+    if (p && (char *) p + old_size == block->data + block->used
+          && block->cap - block->used >= new_size - old_size) {
+        block->used += new_size - old_size;
+        arena->used += new_size - old_size;
+        if (arena->used > arena->peak)
+            arena->peak = arena->used;
+        return p;
+    }
+    void * q = arena_alloc(arena, new_size);
+    if (p)
+        memcpy(q, p, old_size);
+    return q;
+}
+
+// Drops everything but keeps the largest block, so a parser that resets
+// between inputs of similar size stops allocating altogether.
+void
+arena_reset(Arena * arena)
+{
+    ArenaBlock * block = arena->block;
+    if (block == NULL)
+        return;
+    while (block->prev) {
+        ArenaBlock * prev = block->prev;
+        block->prev = prev->prev;
+        counted_free(prev);
+    }
+    block->used = 0;
+    arena->used = 0;
+}
+
+void
+arena_free(Arena * arena)
+{
+    while (arena->block) {
+        ArenaBlock * prev = arena->block->prev;
+        counted_free(arena->block);
+        arena->block = prev;
+    }
+    arena->used = 0;
+}
@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+// Bump allocator for data that lives exactly as long as one parse. Memory
+// comes from a chain of blocks, each at least twice the size of the one
+// before, and is only ever given back all at once.
+
+#define ARENA_ALIGN 16
+
+typedef struct ArenaBlock {
+    struct ArenaBlock * prev;
+    size_t cap;
+    size_t used;
+    _Alignas(ARENA_ALIGN) char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock * block; // current block, NULL until the first allocation
+    size_t used;        // bytes handed out since the last reset
+    size_t peak;        // high-water mark of used
+} Arena;
+
+void * arena_alloc(Arena * arena, size_t size);
+void * arena_grow(Arena * arena, void * p, size_t old_size, size_t new_size);
+void arena_reset(Arena * arena);
+void arena_free(Arena * arena);
+
+#endif /* ARENA_H */
@@ -0,0 +1,335 @@
+#include "alloc.h"
+#include "stb_ds.h"
+#include "common.h"
+#include "symtab.h"
+#include "literal.h"
+#include "ast.h"
+#include "tokenizer.h"
+#include <string.h>
+
+void
+init_ast(Ast * ast)
+{
+    *ast = (Ast) {0};
+    arrput(ast->nodes, (AstNode) { .type = AST_NULL_NODE });
+}
+
+NodeId
+ast_new(Ast * ast, AstNodeType type, uint32_t value, uint32_t nkids, const NodeId * kids)
+{
+    AstNode node = {
+        .type = type,
+        .value = value,
+        .kids = arrlenu(ast->kids),
+        .nkids = nkids,
+    };
+    if (nkids)
+        memcpy(arraddnptr(ast->kids, nkids), kids, nkids * sizeof(*kids));
+    arrput(ast->nodes, node);
+    return arrlenu(ast->nodes) - 1;
+}
+
+NodeId
+ast_leaf(Ast * ast, AstNodeType type, uint32_t value)
+{
+    return ast_new(ast, type, value, 0, NULL);
+}
+
+// Nodes with a variable number of children are built in three steps:
+// remember ast_mark(), ast_push() each child as it is parsed, then
+// ast_finish() moves everything pushed since the mark into the node. Any
+// nodes finished in between push and pop above the mark, so this nests.
+size_t
+ast_mark(const Ast * ast)
+{
+    return arrlenu(ast->stack);
+}
+
+void
+ast_push(Ast * ast, NodeId kid)
+{
+    arrput(ast->stack, kid);
+}
+
+NodeId
+ast_finish(Ast * ast, AstNodeType type, uint32_t value, size_t mark)
+{
+    NodeId id = ast_new(ast, type, value, arrlenu(ast->stack) - mark, ast->stack + mark);
+    arrsetlen(ast->stack, mark);
+    return id;
+}
+
+// Drops the children pushed since mark, for a rule that fails half way.
+void
+ast_unwind(Ast * ast, size_t mark)
+{
+    arrsetlen(ast->stack, mark);
+}
+
+size_t
+ast_bytes(const Ast * ast)
+{
+    return arrlenu(ast->nodes) * sizeof(*ast->nodes) + arrlenu(ast->kids) * sizeof(*ast->kids)
+        + arrlenu(ast->lazy) * sizeof(*ast->lazy)
+        + arrlenu(ast->lazy_types) * (sizeof(*ast->lazy_types) + sizeof(*ast->lazy_values) + sizeof(*ast->lazy_offsets))
+        + arrlenu(ast->lazy_paths) * sizeof(*ast->lazy_paths)
+        + netlist_bytes(&ast->netlist);
+}
+
+size_t
+netlist_bytes(const Netlist * nl)
+{
+    return arrlenu(nl->bodies) * sizeof(*nl->bodies) + arrlenu(nl->cells) * sizeof(*nl->cells)
+        + arrlenu(nl->pin_names) * (sizeof(*nl->pin_names) + sizeof(*nl->pin_nets))
+        + arrlenu(nl->nets) * sizeof(*nl->nets) + arrlenu(nl->net_pins) * sizeof(*nl->net_pins);
+}
+
+static const char * type_names[] = {
+    [AST_NULL_NODE]        = "null_node",
+    [AST_ROOT]             = "root",
+    [AST_MODULE_DEF]       = "module_def",
+    [AST_MODULE_BODY]      = "module_body",
+    [AST_PORT_LIST]        = "port_list",
+    [AST_BITRANGE]         = "bitrange",
+    [AST_NUMBER]           = "number",
+    [AST_INPUT]            = "input",
+    [AST_OUTPUT]           = "output",
+    [AST_PARAM_LIST]       = "param_list",
+    [AST_INSTANTIATION]    = "instantiation",
+    [AST_PORT_MAP_LIST]    = "port_map_list",
+    [AST_PORT_MAP]         = "port_map",
+    [AST_CONT_ASSIGN]      = "cont_assign",
+    [AST_ALWAYS]           = "always",
+    [AST_SENSITIVITY_LIST] = "sensitivity_list",
+    [AST_INITIAL]          = "initial",
+    [AST_IF]               = "if",
+    [AST_NON_BLOCKING]     = "non_blocking",
+    [AST_BLOCKING]         = "blocking",
+    [AST_DPI]              = "dpi",
+    [AST_WIRE_DECL]        = "wire_decl",
+    [AST_REG_DECL]         = "reg_decl",
+    [AST_IDENT]            = "ident",
+    [AST_BITWISE_OR]       = "bitwise_or",
+    [AST_BITWISE_AND]      = "bitwise_and",
+    [AST_BITWISE_XOR]      = "bitwise_xor",
+    [AST_BITWISE_INVERT]   = "bitwise_invert",
+    [AST_LOGICAL_AND]      = "logical_and",
+    [AST_LOGICAL_OR]       = "logical_or",
+    [AST_EQ]               = "eq",
+    [AST_NEQ]              = "neq",
+    [AST_CASE_EQ]          = "case_eq",
+    [AST_CASE_NEQ]         = "case_neq",
+    [AST_LT]               = "lt",
+    [AST_LTE]              = "lte",
+    [AST_GT]               = "gt",
+    [AST_GTE]              = "gte",
+    [AST_LSH]              = "lsh",
+    [AST_RSH]              = "rsh",
+    [AST_ALSH]             = "alsh",
+    [AST_ARSH]             = "arsh",
+    [AST_ADD]              = "add",
+    [AST_SUB]              = "sub",
+    [AST_MUL]              = "mul",
+    [AST_DIV]              = "div",
+    [AST_MOD]              = "mod",
+    [AST_POW]              = "pow",
+    [AST_BITWISE_XNOR]     = "bitwise_xnor",
+    [AST_UNARY_PLUS]       = "unary_plus",
+    [AST_UNARY_MINUS]      = "unary_minus",
+    [AST_LOGICAL_NOT]      = "logical_not",
+    [AST_REDUCE_AND]       = "reduce_and",
+    [AST_REDUCE_NAND]      = "reduce_nand",
+    [AST_REDUCE_OR]        = "reduce_or",
+    [AST_REDUCE_NOR]       = "reduce_nor",
+    [AST_REDUCE_XOR]       = "reduce_xor",
+    [AST_REDUCE_XNOR]      = "reduce_xnor",
+    [AST_TERNARY]          = "ternary",
+    [AST_PAREN]            = "paren",
+    [AST_INDEX]            = "index",
+    [AST_CONCAT]           = "concat",
+    [AST_LITERAL]          = "literal",
+    [AST_DELAY]            = "delay",
+    [AST_BLOCK]            = "block",
+    [AST_LAZY_BODY]        = "lazy_body",
+    [AST_NETLIST_BODY]     = "netlist_body",
+};
+
+// Lower-case name of a node type, as it appears in --emit=json.
+const char *
+ast_type_name(AstNodeType type)
+{
+    return type < NELEMS(type_names) && type_names[type] ? type_names[type] : "unknown";
+}
+
+ValueKind
+ast_value_kind(AstNodeType type)
+{
+    switch (type) {
+        case AST_MODULE_DEF:
+        case AST_INPUT:
+        case AST_OUTPUT:
+        case AST_DPI:
+        case AST_WIRE_DECL:
+        case AST_REG_DECL:
+        case AST_IDENT:
+            return VALUE_SYMBOL;
+        case AST_NUMBER:
+        case AST_LITERAL:
+        case AST_DELAY:
+            return VALUE_LITERAL;
+        case AST_LAZY_BODY:
+            return VALUE_LAZY_BODY;
+        case AST_NETLIST_BODY:
+            return VALUE_NETLIST_BODY;
+        default:
+            return VALUE_NONE;
+    }
+}
+
+static void
+append_netlist(Netlist * dst, const Netlist * src, const Symbol * remap)
+{
+    uint32_t cell_base = arrlenu(dst->cells);
+    uint32_t pin_base = arrlenu(dst->pin_names);
+    uint32_t net_base = arrlenu(dst->nets);
+    uint32_t net_pin_base = arrlenu(dst->net_pins);
+
+    for (size_t i = 0; i < arrlenu(src->bodies); i++) {
+        NetlistBody body = src->bodies[i];
+        body.cell_begin += cell_base;
+        body.cell_end += cell_base;
+        body.net_begin += net_base;
+        body.net_end += net_base;
+        arrput(dst->bodies, body);
+    }
+    for (size_t i = 0; i < arrlenu(src->cells); i++) {
+        Cell cell = src->cells[i];
+        arrput(dst->cells, ((Cell) { remap[cell.type], remap[cell.name], cell.pins + pin_base }));
+    }
+    for (size_t i = 0; i < arrlenu(src->pin_names); i++) {
+        uint32_t net = src->pin_nets[i];
+        arrput(dst->pin_names, remap[src->pin_names[i]]);
+        arrput(dst->pin_nets, net == NET_NONE ? NET_NONE : net + net_base);
+    }
+    for (size_t i = 0; i < arrlenu(src->nets); i++) {
+        Net net = src->nets[i];
+        arrput(dst->nets, ((Net) { remap[net.name], net.bit, net.pins + net_pin_base }));
+    }
+    for (size_t i = 0; i < arrlenu(src->net_pins); i++)
+        arrput(dst->net_pins, src->net_pins[i] + pin_base);
+}
+
+// Copies all of src except its null node to the end of dst, together with
+// its literals, lazy bodies and netlist, and returns the id that src's root has in
+// dst. Symbols are translated through remap, which maps src's symbol table
+// onto dst's.
+NodeId
+ast_append(Ast * dst, const Ast * src, const Symbol * remap)
+{
+    uint32_t node_base = arrlenu(dst->nodes) - 1;
+    uint32_t kid_base = arrlenu(dst->kids);
+    uint32_t lit_base = append_literals(&dst->literals, &src->literals);
+    uint32_t lazy_base = arrlenu(dst->lazy);
+    uint32_t lazy_tok_base = arrlenu(dst->lazy_types);
+    uint32_t netlist_base = arrlenu(dst->netlist.bodies);
+    append_netlist(&dst->netlist, &src->netlist, remap);
+
+    for (size_t i = 0; i < arrlenu(src->lazy); i++) {
+        TokenRange range = src->lazy[i];
+        range.begin += lazy_tok_base;
+        range.end += lazy_tok_base;
+        arrput(dst->lazy, range);
+        arrput(dst->lazy_paths, i < arrlenu(src->lazy_paths) ? src->lazy_paths[i] : NULL);
+    }
+    size_t noffsets = arrlenu(src->lazy_offsets);
+    if (noffsets)
+        memcpy(arraddnptr(dst->lazy_offsets, noffsets), src->lazy_offsets, noffsets * sizeof(*src->lazy_offsets));
+    for (size_t i = 0; i < arrlenu(src->lazy_types); i++) {
+        uint16_t type = src->lazy_types[i];
+        uint32_t value = src->lazy_values[i];
+        if (type == TOK_IDENT)
+            value = remap[value];
+        else if (type == TOK_NUMBER || type == TOK_LITERAL)
+            value += lit_base;
+        arrput(dst->lazy_types, type);
+        arrput(dst->lazy_values, value);
+    }
+
+    NodeId * kids = arraddnptr(dst->kids, arrlenu(src->kids));
+    for (size_t i = 0; i < arrlenu(src->kids); i++)
+        kids[i] = src->kids[i] ? src->kids[i] + node_base : AST_NULL;
+
+    for (size_t i = 1; i < arrlenu(src->nodes); i++) {
+        AstNode node = src->nodes[i];
+        node.kids += kid_base;
+        switch (ast_value_kind(node.type)) {
+            case VALUE_SYMBOL:          node.value = remap[node.value];  break;
+            case VALUE_LITERAL:         node.value += lit_base;          break;
+            case VALUE_LAZY_BODY:       node.value += lazy_base;         break;
+            case VALUE_NETLIST_BODY:    node.value += netlist_base;      break;
+            case VALUE_NONE:                                             break;
+        }
+        arrput(dst->nodes, node);
+    }
+    return src->root ? src->root + node_base : AST_NULL;
+}
+
+typedef struct {
+    NodeId id;
+    uint32_t next;          // next child slot to visit
+} WalkFrame;
+
+void
+ast_walk(Ast * ast, NodeId root, const AstVisitor * visitor, void * user)
+{
+    WalkFrame * stack = NULL;
+    if (visitor->enter)
+        visitor->enter(user, ast, root);
+    arrput(stack, ((WalkFrame) { root, 0 }));
+    while (arrlenu(stack)) {
+        WalkFrame * top = &arrlast(stack);
+        if (top->next == ast_nkids(ast, top->id)) {
+            if (visitor->leave)
+                visitor->leave(user, ast, top->id);
+            arrsetlen(stack, arrlenu(stack) - 1);
+            continue;
+        }
+        NodeId id = top->id;
+        uint32_t i = top->next++;
+        if (visitor->kid && !visitor->kid(user, ast, id, i))
+            continue;
+        NodeId kid = ast_kid(ast, id, i);
+        if (!kid)
+            continue;
+        if (visitor->enter)
+            visitor->enter(user, ast, kid);
+        arrput(stack, ((WalkFrame) { kid, 0 }));
+    }
+    arrfree(stack);
+}
+
+void
+free_netlist(Netlist * nl)
+{
+    arrfree(nl->bodies);
+    arrfree(nl->cells);
+    arrfree(nl->pin_names);
+    arrfree(nl->pin_nets);
+    arrfree(nl->nets);
+    arrfree(nl->net_pins);
+}
+
+void
+free_ast(Ast * ast)
+{
+    arrfree(ast->nodes);
+    arrfree(ast->kids);
+    arrfree(ast->stack);
+    free_literals(&ast->literals);
+    arrfree(ast->lazy);
+    arrfree(ast->lazy_types);
+    arrfree(ast->lazy_values);
+    arrfree(ast->lazy_offsets);
+    arrfree(ast->lazy_paths);
+    free_netlist(&ast->netlist);
+}
@@ -0,0 +1,247 @@
+#ifndef AST_H
+#define AST_H
+
+typedef enum {
+    AST_NULL_NODE=0,
+    AST_ROOT,
+    AST_MODULE_DEF,
+    AST_MODULE_BODY,
+    AST_PORT_LIST,
+    AST_BITRANGE,
+    AST_NUMBER,
+    AST_INPUT,
+    AST_OUTPUT,
+    AST_PARAM_LIST,
+    AST_INSTANTIATION,
+    AST_PORT_MAP_LIST,
+    AST_PORT_MAP,
+    AST_CONT_ASSIGN,
+    AST_ALWAYS,
+    AST_SENSITIVITY_LIST,
+    AST_INITIAL,
+    AST_IF,
+    AST_NON_BLOCKING,
+    AST_BLOCKING,
+    AST_DPI,
+    AST_WIRE_DECL,
+    AST_REG_DECL,
+    AST_IDENT,
+    AST_BITWISE_OR,
+    AST_BITWISE_AND,
+    AST_BITWISE_XOR,
+    AST_BITWISE_INVERT,
+    AST_LOGICAL_AND,
+    AST_LOGICAL_OR,
+    AST_EQ,
+    AST_NEQ,
+    AST_CASE_EQ,
+    AST_CASE_NEQ,
+    AST_LT,
+    AST_LTE,
+    AST_GT,
+    AST_GTE,
+    AST_LSH,
+    AST_RSH,
+    AST_ALSH,
+    AST_ARSH,
+    AST_ADD,
+    AST_SUB,
+    AST_MUL,
+    AST_DIV,
+    AST_MOD,
+    AST_POW,
+    AST_BITWISE_XNOR,
+    AST_UNARY_PLUS,
+    AST_UNARY_MINUS,
+    AST_LOGICAL_NOT,
+    AST_REDUCE_AND,
+    AST_REDUCE_NAND,
+    AST_REDUCE_OR,
+    AST_REDUCE_NOR,
+    AST_REDUCE_XOR,
+    AST_REDUCE_XNOR,
+    AST_TERNARY,
+    AST_PAREN,
+    AST_INDEX,
+    AST_CONCAT,
+    AST_LITERAL,
+    AST_DELAY,
+    AST_BLOCK,
+    AST_LAZY_BODY,
+    AST_NETLIST_BODY,
+} AstNodeType;
+
+// Nodes live in one array and refer to each other by index. The children
+// of a node are the nkids entries of Ast.kids starting at kids, so a node
+// is 16 bytes and a child costs 4. Node 0 is the null node: AST_NULL in a
+// child slot means the child is absent, and parse functions return it
+// for no match.
+typedef uint32_t NodeId;
+
+#define AST_NULL 0
+
+typedef struct {
+    uint16_t type;          // AstNodeType
+    uint32_t value;         // Symbol, or literal index for AST_NUMBER,
+                            // AST_LITERAL and AST_DELAY
+    uint32_t kids;
+    uint32_t nkids;
+} AstNode;
+
+// Tokens of a module body that has not been parsed yet: entries begin to
+// end of Ast.lazy_types and Ast.lazy_values.
+typedef struct {
+    uint32_t begin;
+    uint32_t end;
+} TokenRange;
+
+// Module bodies in netlist mode, see parse_netlist_body(). Instances whose
+// connections are all plain nets are kept as a graph instead of as nodes,
+// in compressed sparse row form: the pins of a cell run from its pins to
+// the next cell's, and the entries of net_pins for a net from its pins to
+// the next net's. A cell costs 12 bytes, a pin 12 and a net 12.
+typedef struct {
+    Symbol type;            // the module or primitive instantiated
+    Symbol name;
+    uint32_t pins;          // first pin
+} Cell;
+
+typedef struct {
+    Symbol name;            // or the text of a constant
+    int32_t bit;            // NET_WHOLE unless a single bit is selected
+    uint32_t pins;          // first entry in net_pins
+} Net;
+
+#define NET_WHOLE   (-1)
+#define NET_NONE    UINT32_MAX  // in pin_nets: not connected
+
+// One module's share. Its first nports nets are its ports, in order.
+typedef struct {
+    uint32_t cell_begin;
+    uint32_t cell_end;
+    uint32_t net_begin;
+    uint32_t net_end;
+    uint32_t nports;
+} NetlistBody;
+
+typedef struct {
+    NetlistBody * bodies;   // stb_ds arrays
+    Cell * cells;
+    Symbol * pin_names;     // indexed by pin
+    uint32_t * pin_nets;    // indexed by pin
+    Net * nets;
+    uint32_t * net_pins;    // pins, grouped by net
+} Netlist;
+
+typedef struct {
+    AstNode * nodes;        // stb_ds array
+    NodeId * kids;          // stb_ds array
+    NodeId * stack;         // children of the nodes still being built
+    NodeId root;
+    LiteralTable literals;  // taken over from the TokenList
+
+    // Lazy module bodies, see expand_module_body(). An AST_LAZY_BODY's
+    // value indexes lazy and its kids are the AST_IDENT names of the
+    // modules it instantiates, so the hierarchy is known without parsing.
+    // lazy_offsets gives the byte offset of each token in its file, and
+    // lazy_paths the file of each body where known, so that a body that
+    // fails to expand can be reported like any other syntax error.
+    TokenRange * lazy;      // stb_ds arrays
+    uint16_t * lazy_types;
+    uint32_t * lazy_values;
+    size_t * lazy_offsets;
+    const char ** lazy_paths;   // not owned; shorter than lazy if not known
+
+    // AST_NETLIST_BODY's value indexes netlist.bodies and its kids are the
+    // items of the body that are not in the graph.
+    Netlist netlist;
+} Ast;
+
+// What AstNode.value holds for a node type.
+typedef enum {
+    VALUE_NONE,
+    VALUE_SYMBOL,
+    VALUE_LITERAL,
+    VALUE_LAZY_BODY,
+    VALUE_NETLIST_BODY,
+} ValueKind;
+
+// Depth-first walk over the tree under a node. The walk keeps its own
+// stack on the heap, so trees of any depth can be walked. enter() sees a
+// node before its kids and leave() after them. kid() is called before
+// each child slot, null ones included, and returns whether to walk that
+// child; null children are never walked. Any callback may be NULL.
+// Callbacks may add nodes, and a node's kids are only read once enter()
+// has returned, so enter() may replace them.
+typedef struct {
+    void (*enter)(void * user, Ast * ast, NodeId id);
+    bool (*kid)(void * user, Ast * ast, NodeId id, uint32_t i);
+    void (*leave)(void * user, Ast * ast, NodeId id);
+} AstVisitor;
+
+void init_ast(Ast * ast);
+NodeId ast_new(Ast * ast, AstNodeType type, uint32_t value, uint32_t nkids, const NodeId * kids);
+NodeId ast_leaf(Ast * ast, AstNodeType type, uint32_t value);
+size_t ast_mark(const Ast * ast);
+void ast_push(Ast * ast, NodeId kid);
+NodeId ast_finish(Ast * ast, AstNodeType type, uint32_t value, size_t mark);
+void ast_unwind(Ast * ast, size_t mark);
+size_t ast_bytes(const Ast * ast);
+size_t netlist_bytes(const Netlist * nl);
+const char * ast_type_name(AstNodeType type);
+ValueKind ast_value_kind(AstNodeType type);
+NodeId ast_append(Ast * dst, const Ast * src, const Symbol * remap);
+void ast_walk(Ast * ast, NodeId root, const AstVisitor * visitor, void * user);
+void free_netlist(Netlist * nl);
+void free_ast(Ast * ast);
+
+static inline AstNodeType
+ast_type(const Ast * ast, NodeId id)
+{
+    return ast->nodes[id].type;
+}
+
+static inline uint32_t
+ast_value(const Ast * ast, NodeId id)
+{
+    return ast->nodes[id].value;
+}
+
+static inline uint32_t
+ast_nkids(const Ast * ast, NodeId id)
+{
+    return ast->nodes[id].nkids;
+}
+
+static inline const NodeId *
+ast_kids(const Ast * ast, NodeId id)
+{
+    return ast->kids + ast->nodes[id].kids;
+}
+
+static inline NodeId
+ast_kid(const Ast * ast, NodeId id, uint32_t i)
+{
+    return ast->kids[ast->nodes[id].kids + i];
+}
+
+// Integer value of an AST_NUMBER or AST_DELAY.
+static inline int64_t
+ast_number(const Ast * ast, NodeId id)
+{
+    return literal_int64(&ast->literals, ast->nodes[id].value);
+}
+
+static inline uint32_t
+cell_pins_end(const Netlist * nl, uint32_t cell)
+{
+    return cell + 1 < arrlenu(nl->cells) ? nl->cells[cell + 1].pins : arrlenu(nl->pin_names);
+}
+
+static inline uint32_t
+net_pins_end(const Netlist * nl, uint32_t net)
+{
+    return net + 1 < arrlenu(nl->nets) ? nl->nets[net + 1].pins : arrlenu(nl->net_pins);
+}
+
+#endif /* AST_H */
@@ -0,0 +1,358 @@
+#include "alloc.h"
+#include "stb_ds.h"
+#include "common.h"
+#include "symtab.h"
+#include "literal.h"
+#include "arena.h"
+#include "ast.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC "VPASTC\r\n"    // the \r\n catches text-mode mangling
+
+enum {
+    SEC_NODES,
+    SEC_KIDS,
+    SEC_LITS,
+    SEC_WORDS,
+    SEC_LAZY,
+    SEC_LAZY_TYPES,
+    SEC_LAZY_VALUES,
+    SEC_LAZY_OFFSETS,
+    SEC_SYM_OFFSETS,    // uint32_t per symbol, into SEC_NAMES
+    SEC_NAMES,          // NUL-terminated
+    NUM_SECTIONS
+};
+
+static const size_t section_elem_size[NUM_SECTIONS] = {
+    [SEC_NODES]         = sizeof(AstNode),
+    [SEC_KIDS]          = sizeof(NodeId),
+    [SEC_LITS]          = sizeof(Literal),
+    [SEC_WORDS]         = sizeof(uint64_t),
+    [SEC_LAZY]          = sizeof(TokenRange),
+    [SEC_LAZY_TYPES]    = sizeof(uint16_t),
+    [SEC_LAZY_VALUES]   = sizeof(uint32_t),
+    [SEC_LAZY_OFFSETS]  = sizeof(size_t),
+    [SEC_SYM_OFFSETS]   = sizeof(uint32_t),
+    [SEC_NAMES]         = 1,
+};
+
+// Sections follow the header in order, each starting 8-byte aligned. The
+// sizes of the structs are part of the header so that a build with a
+// different layout reads a mismatch rather than garbage.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t elem_size[NUM_SECTIONS];
+    uint32_t root;
+    uint64_t key;
+    uint64_t checksum;      // hash_bytes() of everything after the header
+    uint64_t count[NUM_SECTIONS];
+} CacheHeader;
+
+#define ALIGN8(x) (((x) + 7) & ~(size_t) 7)
+
+// 8 bytes per step, like hash_name() in symtab.c, but 64 bits wide
+static uint64_t
+hash_bytes(const char * p, size_t len, uint64_t h)
+{
+    h ^= len * 0x9e3779b97f4a7c15ull;
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+        p += 8;
+        len -= 8;
+    }
+    uint64_t w = 0;
+    memcpy(&w, p, len);
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 29;
+    return h;
+}
+
+uint64_t
+cache_key(Buffer input, bool lazy)
+{
+    return hash_bytes(input.p, input.len, PARSER_VERSION * 2 + lazy);
+}
+
+static void
+entry_path(char * path, size_t cap, const char * dir, uint64_t key)
+{
+    snprintf(path, cap, "%s/%016llx.ast", dir, (unsigned long long) key);
+}
+
+static void
+header_init(CacheHeader * header, uint64_t key)
+{
+    *header = (CacheHeader) { .version = PARSER_VERSION, .key = key };
+    memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+    for (int i = 0; i < NUM_SECTIONS; i++)
+        header->elem_size[i] = section_elem_size[i];
+}
+
+// Returns false, leaving ast and symtab untouched, on a miss or on an
+// entry that does not check out.
+bool
+load_cached_ast(const char * dir, uint64_t key, Ast * ast, SymbolTable * symtab)
+{
+    char path[4096];
+    entry_path(path, sizeof(path), dir, key);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat sb;
+    if (fstat(fd, &sb) == -1 || (size_t) sb.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t size = sb.st_size;
+    const char * map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    CacheHeader expect, header;
+    header_init(&expect, key);
+    memcpy(&header, map, sizeof(header));
+    bool ok = !memcmp(header.magic, expect.magic, sizeof(header.magic))
+        && header.version == expect.version && header.key == key
+        && !memcmp(header.elem_size, expect.elem_size, sizeof(header.elem_size));
+    const char * sections[NUM_SECTIONS];
+    size_t pos = ALIGN8(sizeof(header));
+    for (int i = 0; ok && i < NUM_SECTIONS; i++) {
+        size_t bytes = header.count[i] * section_elem_size[i];
+        ok = header.count[i] <= size && bytes <= size - pos;
+        sections[i] = map + pos;
+        pos = ALIGN8(pos + bytes);
+    }
+    ok = ok && hash_bytes(map + sizeof(header), size - sizeof(header), 0) == header.checksum;
+    ok = ok && header.count[SEC_NODES] > header.root && header.count[SEC_NAMES] > 0
+        && sections[SEC_NAMES][header.count[SEC_NAMES] - 1] == '\0';
+    if (!ok) {
+        munmap((void *) map, size);
+        return false;
+    }
+
+    // everything that indexes another section is checked before use
+    const uint32_t * sym_offsets = (const uint32_t *) sections[SEC_SYM_OFFSETS];
+    const AstNode * nodes = (const AstNode *) sections[SEC_NODES];
+    const NodeId * kids = (const NodeId *) sections[SEC_KIDS];
+    const uint16_t * lazy_types = (const uint16_t *) sections[SEC_LAZY_TYPES];
+    const uint32_t * lazy_values = (const uint32_t *) sections[SEC_LAZY_VALUES];
+    uint64_t nsyms = header.count[SEC_SYM_OFFSETS];
+    ok = header.count[SEC_LAZY_TYPES] == header.count[SEC_LAZY_VALUES]
+        && header.count[SEC_LAZY_TYPES] == header.count[SEC_LAZY_OFFSETS];
+    for (size_t i = 0; ok && i < nsyms; i++)
+        ok = sym_offsets[i] < header.count[SEC_NAMES];
+    uint64_t value_limit[] = {
+        [VALUE_NONE]            = UINT64_MAX,
+        [VALUE_SYMBOL]          = nsyms,
+        [VALUE_LITERAL]         = header.count[SEC_LITS],
+        [VALUE_LAZY_BODY]       = header.count[SEC_LAZY],
+        [VALUE_NETLIST_BODY]    = 0,    // netlists are never cached
+    };
+    for (size_t i = 0; ok && i < header.count[SEC_NODES]; i++)
+        ok = (uint64_t) nodes[i].kids + nodes[i].nkids <= header.count[SEC_KIDS]
+            && nodes[i].value < value_limit[ast_value_kind(nodes[i].type)];
+    for (size_t i = 0; ok && i < header.count[SEC_KIDS]; i++)
+        ok = kids[i] < header.count[SEC_NODES];
+    for (size_t i = 0; ok && i < header.count[SEC_LAZY_TYPES]; i++) {
+        TokenType type = lazy_types[i];
+        ok = lazy_values[i] < (type == TOK_IDENT ? nsyms
+            : type == TOK_NUMBER || type == TOK_LITERAL ? header.count[SEC_LITS] : UINT64_MAX);
+    }
+    for (size_t i = 0; ok && i < header.count[SEC_LAZY]; i++) {
+        const TokenRange * range = (const TokenRange *) sections[SEC_LAZY] + i;
+        ok = range->begin <= range->end && range->end <= header.count[SEC_LAZY_TYPES];
+    }
+    for (size_t i = 0; ok && i < header.count[SEC_LITS]; i++) {
+        const Literal * lit = (const Literal *) sections[SEC_LITS] + i;
+        ok = lit->width <= 64 || (lit->word_offset <= header.count[SEC_WORDS]
+            && 2 * (((uint64_t) lit->width + 63) / 64) <= header.count[SEC_WORDS] - lit->word_offset);
+    }
+    if (!ok) {
+        munmap((void *) map, size);
+        return false;
+    }
+
+    Symbol * remap = NULL;
+    for (size_t i = 0; i < nsyms; i++) {
+        const char * name = sections[SEC_NAMES] + sym_offsets[i];
+        arrput(remap, intern(symtab, name, strlen(name)));
+    }
+
+    init_ast(ast);
+    arrsetlen(ast->nodes, 0);
+    #define LOAD(arr, sec) \
+        if (header.count[sec]) \
+            memcpy(arraddnptr(arr, header.count[sec]), sections[sec], header.count[sec] * section_elem_size[sec])
+    LOAD(ast->nodes, SEC_NODES);
+    LOAD(ast->kids, SEC_KIDS);
+    LOAD(ast->literals.lits, SEC_LITS);
+    LOAD(ast->literals.words, SEC_WORDS);
+    LOAD(ast->lazy, SEC_LAZY);
+    LOAD(ast->lazy_types, SEC_LAZY_TYPES);
+    LOAD(ast->lazy_values, SEC_LAZY_VALUES);
+    LOAD(ast->lazy_offsets, SEC_LAZY_OFFSETS);
+    #undef LOAD
+    ast->root = header.root;
+    munmap((void *) map, size);
+
+    for (size_t i = 0; i < arrlenu(ast->nodes); i++)
+        if (ast_value_kind(ast->nodes[i].type) == VALUE_SYMBOL)
+            ast->nodes[i].value = remap[ast->nodes[i].value];
+    for (size_t i = 0; i < arrlenu(ast->lazy_types); i++)
+        if (ast->lazy_types[i] == TOK_IDENT)
+            ast->lazy_values[i] = remap[ast->lazy_values[i]];
+    arrfree(remap);
+    return true;
+}
+
+static int
+compare_symbols(const void * a, const void * b)
+{
+    Symbol x = *(const Symbol *) a, y = *(const Symbol *) b;
+    return x < y ? -1 : x > y;
+}
+
+// Index of sym in the sorted array syms, which holds it.
+static uint32_t
+local_symbol(const Symbol * syms, size_t nsyms, Symbol sym)
+{
+    size_t lo = 0, hi = nsyms;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (syms[mid] <= sym)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// The entry for ast as one stb_ds array of bytes. Any ast will do: with
+// key 0 this is also the image --emit=bin writes.
+char *
+serialize_ast(uint64_t key, const Ast * ast, const SymbolTable * symtab)
+{
+    // The symtab is shared with every other input the worker has parsed,
+    // so only the symbols this tree uses are written, renumbered from 0.
+    Symbol * syms = NULL;
+    for (size_t i = 0; i < arrlenu(ast->nodes); i++)
+        if (ast_value_kind(ast->nodes[i].type) == VALUE_SYMBOL)
+            arrput(syms, ast->nodes[i].value);
+    for (size_t i = 0; i < arrlenu(ast->lazy_types); i++)
+        if (ast->lazy_types[i] == TOK_IDENT)
+            arrput(syms, ast->lazy_values[i]);
+    size_t nsyms = 0;
+    if (syms) {
+        qsort(syms, arrlenu(syms), sizeof(*syms), compare_symbols);
+        for (size_t i = 0; i < arrlenu(syms); i++)
+            if (nsyms == 0 || syms[i] != syms[nsyms - 1])
+                syms[nsyms++] = syms[i];
+    }
+    uint32_t * sym_offsets = NULL;
+    char * names = NULL;
+    arrput(names, '\0');
+    for (size_t i = 0; i < nsyms; i++) {
+        arrput(sym_offsets, arrlenu(names));
+        size_t len = sym_len(symtab, syms[i]) + 1;
+        memcpy(arraddnptr(names, len), sym_str(symtab, syms[i]), len);
+    }
+
+    AstNode * nodes = NULL;
+    uint32_t * lazy_values = NULL;
+    memcpy(arraddnptr(nodes, arrlenu(ast->nodes)), ast->nodes, arrlenu(ast->nodes) * sizeof(*nodes));
+    for (size_t i = 0; i < arrlenu(nodes); i++)
+        if (ast_value_kind(nodes[i].type) == VALUE_SYMBOL)
+            nodes[i].value = local_symbol(syms, nsyms, nodes[i].value);
+    for (size_t i = 0; i < arrlenu(ast->lazy_types); i++) {
+        uint32_t value = ast->lazy_values[i];
+        if (ast->lazy_types[i] == TOK_IDENT)
+            value = local_symbol(syms, nsyms, value);
+        arrput(lazy_values, value);
+    }
+
+    CacheHeader header;
+    header_init(&header, key);
+    header.root = ast->root;
+    const void * sections[NUM_SECTIONS] = {
+        [SEC_NODES]         = nodes,
+        [SEC_KIDS]          = ast->kids,
+        [SEC_LITS]          = ast->literals.lits,
+        [SEC_WORDS]         = ast->literals.words,
+        [SEC_LAZY]          = ast->lazy,
+        [SEC_LAZY_TYPES]    = ast->lazy_types,
+        [SEC_LAZY_VALUES]   = lazy_values,
+        [SEC_LAZY_OFFSETS]  = ast->lazy_offsets,
+        [SEC_SYM_OFFSETS]   = sym_offsets,
+        [SEC_NAMES]         = names,
+    };
+    header.count[SEC_NODES] = arrlenu(nodes);
+    header.count[SEC_KIDS] = arrlenu(ast->kids);
+    header.count[SEC_LITS] = arrlenu(ast->literals.lits);
+    header.count[SEC_WORDS] = arrlenu(ast->literals.words);
+    header.count[SEC_LAZY] = arrlenu(ast->lazy);
+    header.count[SEC_LAZY_TYPES] = arrlenu(ast->lazy_types);
+    header.count[SEC_LAZY_VALUES] = arrlenu(lazy_values);
+    header.count[SEC_LAZY_OFFSETS] = arrlenu(ast->lazy_offsets);
+    header.count[SEC_SYM_OFFSETS] = arrlenu(sym_offsets);
+    header.count[SEC_NAMES] = arrlenu(names);
+
+    char * out = NULL;
+    memset(arraddnptr(out, ALIGN8(sizeof(header))), 0, ALIGN8(sizeof(header)));
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        size_t bytes = header.count[i] * section_elem_size[i];
+        if (bytes)
+            memcpy(arraddnptr(out, bytes), sections[i], bytes);
+        size_t pad = ALIGN8(arrlenu(out)) - arrlenu(out);
+        if (pad)
+            memset(arraddnptr(out, pad), 0, pad);
+    }
+    header.checksum = hash_bytes(out + sizeof(header), arrlenu(out) - sizeof(header), 0);
+    memcpy(out, &header, sizeof(header));
+
+    arrfree(syms);
+    arrfree(sym_offsets);
+    arrfree(names);
+    arrfree(nodes);
+    arrfree(lazy_values);
+    return out;
+}
+
+// Writes the entry under a temporary name and renames it into place, so
+// readers never see half an entry and concurrent writers of the same key
+// do not interfere. Failures only cost a cache miss next time, so they
+// are not reported.
+void
+store_cached_ast(const char * dir, uint64_t key, const Ast * ast, const SymbolTable * symtab)
+{
+    mkdir(dir, 0777);
+    char * out = serialize_ast(key, ast, symtab);
+
+    char path[4096], tmp_path[4096];
+    entry_path(path, sizeof(path), dir, key);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.%lx.tmp", path, (long) getpid(), (unsigned long) pthread_self());
+    FILE * fp = fopen(tmp_path, "wb");
+    if (fp) {
+        bool ok = fwrite(out, 1, arrlenu(out), fp) == arrlenu(out);
+        ok = fclose(fp) == 0 && ok;
+        if (!ok || rename(tmp_path, path) == -1)
+            unlink(tmp_path);
+    }
+
+    arrfree(out);
+}
@@ -0,0 +1,19 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+// On-disk AST cache. Each entry is one parsed input serialized as the
+// Ast's own arrays, which hold indices rather than pointers and so can be
+// written and read back as they are, plus the names its symbols refer to.
+// Entries are named after cache_key(), a hash of the input together with
+// PARSER_VERSION and the options that change the tree, and are read back
+// by mapping the file; only the symbols need translating, into the
+// loading context's table. The same image is the --emit=bin format, for
+// other processes to map: a CacheHeader, then the sections it counts, see
+// cache.c. Node types are AstNodeType and symbols index SEC_SYM_OFFSETS.
+
+uint64_t cache_key(Buffer input, bool lazy);
+bool load_cached_ast(const char * dir, uint64_t key, Ast * ast, SymbolTable * symtab);
+char * serialize_ast(uint64_t key, const Ast * ast, const SymbolTable * symtab);
+void store_cached_ast(const char * dir, uint64_t key, const Ast * ast, const SymbolTable * symtab);
+
+#endif /* CACHE_H */
@@ -4,12 +4,16 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <errno.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <time.h>
 
 void
 die(const char * fmt, ...)
@@ -21,33 +25,98 @@ die(const char * fmt, ...)
     exit(EXIT_FAILURE);
 }
 
+// Regular files are memory-mapped: an anonymous mapping of len +
+// BUFFER_PADDING zero bytes is reserved first and the file is mapped over
+// its start, which leaves the padding in place without copying the file.
+static bool
+map_file(int fd, size_t len, Buffer * buffer)
+{
+    size_t cap = len + BUFFER_PADDING;
+    char * p = mmap(NULL, cap, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return false;
+    if (mmap(p, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(p, cap);
+        return false;
+    }
+    madvise(p, len, MADV_SEQUENTIAL);
+    *buffer = (Buffer) { .p = p, .len = len, .cap = cap, .mapped = true };
+    return true;
+}
+
+// Pipes, character devices and anything mmap() refuses are read in chunks.
+static Buffer
+slurp_file(int fd, const char * filename, size_t size_hint)
+{
+    Buffer buffer = { .cap = size_hint + BUFFER_PADDING };
+    if (buffer.cap < 65536)
+        buffer.cap = 65536;
+    buffer.p = malloc(buffer.cap);
+    while (1) {
+        if (buffer.cap - buffer.len < BUFFER_PADDING + 4096) {
+            buffer.cap *= 2;
+            buffer.p = realloc(buffer.p, buffer.cap);
+        }
+        if (buffer.p == NULL)
+            die("%s: out of memory\n", filename);
+        ssize_t n = read(fd, buffer.p + buffer.len, buffer.cap - buffer.len - BUFFER_PADDING);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror(filename);
+            exit(EXIT_FAILURE);
+        }
+        if (n == 0)
+            break;
+        buffer.len += n;
+    }
+    memset(buffer.p + buffer.len, 0, BUFFER_PADDING);
+    return buffer;
+}
+
 Buffer
 read_file(const char * filename)
 {
-    FILE * fp = fopen(filename, "r");
-    if (fp == NULL) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
         perror(filename);
         exit(EXIT_FAILURE);
     }
     struct stat sb;
-    if (fstat(fileno(fp), &sb) == -1) {
+    if (fstat(fd, &sb) == -1) {
         perror(filename);
         exit(EXIT_FAILURE);
     }
     Buffer buffer;
-    buffer.cap = (size_t) (sb.st_size);
-    buffer.len = buffer.cap;
-    buffer.p = malloc(sizeof(*buffer.p)*buffer.cap);
-    fread(buffer.p, 1, buffer.len, fp);
-    if (ferror(fp)) {
-        perror(filename);
-        exit(EXIT_FAILURE);
-    }
-    fclose(fp);
+    if (!S_ISREG(sb.st_mode) || sb.st_size == 0 || !map_file(fd, (size_t) sb.st_size, &buffer))
+        buffer = slurp_file(fd, filename, S_ISREG(sb.st_mode) ? (size_t) sb.st_size : 0);
+    close(fd);
+    return buffer;
+}
+
+// A padded copy of len bytes at p, for handing part of a buffer to the
+// tokenizer.
+Buffer
+copy_buffer(const char * p, size_t len)
+{
+    Buffer buffer = { .p = malloc(len + BUFFER_PADDING), .len = len, .cap = len + BUFFER_PADDING };
+    if (buffer.p == NULL)
+        die("error: out of memory for a %zu byte buffer\n", len);
+    memcpy(buffer.p, p, len);
+    memset(buffer.p + len, 0, BUFFER_PADDING);
     return buffer;
 }
 
-#if 0
+void
+free_buffer(Buffer * buffer)
+{
+    if (buffer->mapped)
+        munmap(buffer->p, buffer->cap);
+    else
+        free(buffer->p);
+    *buffer = (Buffer) {0};
+}
+
 const char *
 parse_int_strerror(int errnum)
 {
@@ -81,4 +150,51 @@ parse_int(const char * s, int * x) {
     *x = (int) sl;
     return 0;
 }
-#endif
+
+static const char * phase_names[] = {
+    [PHASE_READ]    = "read",
+    [PHASE_LEX]     = "lex",
+    [PHASE_PARSE]   = "parse",
+    [PHASE_PRINT]   = "print",
+    [PHASE_FREE]    = "free",
+};
+
+const char *
+phase_name(Phase phase)
+{
+    return phase_names[phase];
+}
+
+static double
+clock_seconds(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+Stopwatch
+start_stopwatch(void)
+{
+    return (Stopwatch) {
+        .wall = clock_seconds(CLOCK_MONOTONIC),
+        .cpu = clock_seconds(CLOCK_THREAD_CPUTIME_ID),
+    };
+}
+
+// Adds the time since sw was started to phase.
+void
+stop_stopwatch(Stopwatch sw, PhaseTimes * times, Phase phase)
+{
+    times->wall[phase] += clock_seconds(CLOCK_MONOTONIC) - sw.wall;
+    times->cpu[phase] += clock_seconds(CLOCK_THREAD_CPUTIME_ID) - sw.cpu;
+}
+
+void
+add_phase_times(PhaseTimes * dst, const PhaseTimes * src)
+{
+    for (int i = 0; i < NUM_PHASES; i++) {
+        dst->wall[i] += src->wall[i];
+        dst->cpu[i] += src->cpu[i];
+    }
+}
@@ -7,15 +7,49 @@
 
 #define NELEMS(X) sizeof(X)/sizeof(X[0])
 
+// Buffers returned by read_file() are followed by at least BUFFER_PADDING
+// NUL bytes. The tokenizer relies on this: p[len] reads as '\0' and
+// ends every token, and vector scanners may load past len without
+// checking, so the lexer's inner loops need no bounds checks.
+#define BUFFER_PADDING 64
+
 typedef struct {
     char * p;
     size_t len;
     size_t cap;
+    bool mapped;
 } Buffer;
 
+// Phase timers for --stats. Every thread adds its own time, so with
+// several workers a phase can add up to more than the whole run took.
+typedef enum {
+    PHASE_READ,
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_PRINT,
+    PHASE_FREE,
+    NUM_PHASES
+} Phase;
+
+typedef struct {
+    double wall[NUM_PHASES];    // seconds
+    double cpu[NUM_PHASES];     // seconds of CPU time of the timing thread
+} PhaseTimes;
+
+typedef struct {
+    double wall;
+    double cpu;
+} Stopwatch;
+
 void die(const char * fmt, ...);
 Buffer read_file(const char * filename);
-//const char * parse_int_strerror(int errnum);
-//int parse_int(const char * s, int * x);
+Buffer copy_buffer(const char * p, size_t len);
+void free_buffer(Buffer * buffer);
+const char * parse_int_strerror(int errnum);
+int parse_int(const char * s, int * x);
+const char * phase_name(Phase phase);
+Stopwatch start_stopwatch(void);
+void stop_stopwatch(Stopwatch sw, PhaseTimes * times, Phase phase);
+void add_phase_times(PhaseTimes * dst, const PhaseTimes * src);
 
 #endif /* COMMON_H */
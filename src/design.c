@@ -0,0 +1,319 @@
+#include "alloc.h"
+#include "stb_ds.h"
+#include "common.h"
+#include "symtab.h"
+#include "literal.h"
+#include "arena.h"
+#include "ast.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "pool.h"
+#include "split.h"
+#include "cache.h"
+#include "design.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Files at least twice this size are cut at module boundaries into pieces
+// of at least this size, and the pieces parsed as separate tasks.
+#ifndef SPLIT_MIN_CHUNK
+#define SPLIT_MIN_CHUNK (256 * 1024)
+#endif
+
+typedef struct SourceUnit SourceUnit;
+
+typedef struct {
+    SourceUnit * unit;
+    size_t begin;
+    size_t end;
+    Ast ast;
+    Diagnostic * diags;
+    int worker;         // whose symbol table ast refers to
+    bool cached;
+} Chunk;
+
+struct SourceUnit {
+    const char * path;
+    ParseCtx * ctxs;    // indexed by worker
+    Pool * pool;
+    const DesignOptions * opts;
+    Buffer input;
+    Chunk * chunks;     // stb_ds array, in source order
+};
+
+// Parses input with ctx, or takes the tree from the AST cache when there
+// is one and it has an entry for input. Trees with errors are not cached,
+// so that their diagnostics are reported on every run, and neither are
+// netlists. Returns true on a cache hit.
+static bool
+parse_or_load(ParseCtx * ctx, Buffer input, const char * cache_dir)
+{
+    if (cache_dir == NULL || ctx->netlist) {
+        parse_verilog(ctx, input);
+        return false;
+    }
+    uint64_t key = cache_key(input, ctx->lazy);
+    Ast ast;
+    if (load_cached_ast(cache_dir, key, &ast, &ctx->symtab)) {
+        free_ast(&ctx->ast);
+        ctx->ast = ast;
+        arrsetlen(ctx->diags, 0);
+        arrsetlen(ctx->spans, 0);
+        return true;
+    }
+    parse_verilog(ctx, input);
+    if (arrlenu(ctx->diags) == 0)
+        store_cached_ast(cache_dir, key, &ctx->ast, &ctx->symtab);
+    return false;
+}
+
+static void
+parse_buffer(Chunk * chunk, ParseCtx * ctx, Buffer input, int worker)
+{
+    chunk->cached = parse_or_load(ctx, input, chunk->unit->opts->cache_dir);
+    chunk->ast = ctx->ast;
+    chunk->diags = ctx->diags;
+    chunk->worker = worker;
+    ctx->ast = (Ast) {0};
+    ctx->diags = NULL;
+}
+
+// The tokenizer needs NUL padding after the last byte, so each piece is
+// copied out of the file rather than parsed in place.
+static void
+parse_chunk(void * arg, int worker)
+{
+    Chunk * chunk = arg;
+    Buffer input = copy_buffer(chunk->unit->input.p + chunk->begin, chunk->end - chunk->begin);
+    parse_buffer(chunk, &chunk->unit->ctxs[worker], input, worker);
+    free_buffer(&input);
+}
+
+static void
+parse_unit(void * arg, int worker)
+{
+    SourceUnit * unit = arg;
+    Stopwatch sw = start_stopwatch();
+    unit->input = read_file(unit->path);
+    stop_stopwatch(sw, &unit->ctxs[worker].stats.times, PHASE_READ);
+
+    int nthreads = unit->opts->nthreads;
+    size_t min_chunk = unit->input.len / (4 * nthreads);
+    if (min_chunk < SPLIT_MIN_CHUNK)
+        min_chunk = SPLIT_MIN_CHUNK;
+    size_t * cuts = NULL;
+    if (nthreads > 1 && unit->input.len >= 2 * SPLIT_MIN_CHUNK)
+        cuts = split_at_modules(unit->input, min_chunk);
+
+    if (arrlenu(cuts) < 2) {
+        arrsetlen(unit->chunks, 1);
+        unit->chunks[0] = (Chunk) { .unit = unit, .end = unit->input.len };
+        parse_buffer(&unit->chunks[0], &unit->ctxs[worker], unit->input, worker);
+        free_buffer(&unit->input);
+        arrfree(cuts);
+        return;
+    }
+
+    // the array must not move once tasks hold pointers into it
+    arrsetlen(unit->chunks, arrlenu(cuts));
+    for (size_t i = 0; i < arrlenu(cuts); i++) {
+        size_t end = i + 1 < arrlenu(cuts) ? cuts[i + 1] : unit->input.len;
+        unit->chunks[i] = (Chunk) { .unit = unit, .begin = cuts[i], .end = end };
+    }
+    for (size_t i = 0; i < arrlenu(cuts); i++)
+        pool_submit(unit->pool, parse_chunk, &unit->chunks[i]);
+    arrfree(cuts);
+}
+
+Design
+parse_design(char ** paths, size_t npaths, const DesignOptions * opts)
+{
+    Design design = {0};
+    int nthreads = opts->nthreads;
+
+    if (npaths == 1 && nthreads == 1) {
+        // nothing to merge: keep the tree and names as they are
+        ParseCtx ctx = init_parse_ctx(opts->use_memo, opts->lazy, opts->netlist);
+        Stopwatch sw = start_stopwatch();
+        Buffer input = read_file(paths[0]);
+        stop_stopwatch(sw, &ctx.stats.times, PHASE_READ);
+        design.cache_hits = parse_or_load(&ctx, input, opts->cache_dir);
+        design.cache_lookups = opts->cache_dir != NULL && !opts->netlist;
+        free_buffer(&input);
+        design.ast = ctx.ast;
+        design.symtab = ctx.symtab;
+        design.memo_hits = ctx.memo_hits;
+        design.stats = ctx.stats;
+        design.arena_peak = ctx.arena.peak;
+        design.diags = ctx.diags;
+        for (size_t i = 0; i < arrlenu(design.diags); i++)
+            design.diags[i].path = paths[0];
+        arrsetlen(design.ast.lazy_paths, arrlenu(design.ast.lazy));
+        for (size_t i = 0; i < arrlenu(design.ast.lazy); i++)
+            design.ast.lazy_paths[i] = paths[0];
+        ctx.ast = (Ast) {0};
+        ctx.diags = NULL;
+        ctx.symtab = (SymbolTable) {0};
+        free_parse_ctx(&ctx);
+        return design;
+    }
+
+    ParseCtx * ctxs = malloc(nthreads * sizeof(*ctxs));
+    SourceUnit * units = calloc(npaths, sizeof(*units));
+    if (ctxs == NULL || units == NULL)
+        die("error: out of memory for %zu source files\n", npaths);
+    for (int i = 0; i < nthreads; i++)
+        ctxs[i] = init_parse_ctx(opts->use_memo, opts->lazy, opts->netlist);
+
+    Pool pool;
+    init_pool(&pool, nthreads);
+    for (size_t i = 0; i < npaths; i++) {
+        units[i] = (SourceUnit) { .path = paths[i], .ctxs = ctxs, .pool = &pool, .opts = opts };
+        pool_submit(&pool, parse_unit, &units[i]);
+    }
+    pool_wait(&pool);
+    free_pool(&pool);
+
+    // one remap per worker, from its symbol table to the design's
+    Symbol ** remaps = malloc(nthreads * sizeof(*remaps));
+    if (remaps == NULL)
+        die("error: out of memory for symbol remap\n");
+    for (int i = 0; i < nthreads; i++) {
+        const SymbolTable * symtab = &ctxs[i].symtab;
+        remaps[i] = NULL;
+        for (Symbol sym = 0; sym < num_symbols(symtab); sym++)
+            arrput(remaps[i], intern(&design.symtab, sym_str(symtab, sym), sym_len(symtab, sym)));
+    }
+
+    init_ast(&design.ast);
+    size_t mark = ast_mark(&design.ast);
+    for (size_t i = 0; i < npaths; i++) {
+        for (size_t c = 0; c < arrlenu(units[i].chunks); c++) {
+            Chunk * chunk = &units[i].chunks[c];
+            design.cache_hits += chunk->cached;
+            design.cache_lookups += opts->cache_dir != NULL && !opts->netlist;
+            size_t lazy_base = arrlenu(design.ast.lazy);
+            size_t lazy_tok_base = arrlenu(design.ast.lazy_offsets);
+            NodeId root = ast_append(&design.ast, &chunk->ast, remaps[chunk->worker]);
+            // lazy bodies are reported against the file, as diags are below
+            for (size_t k = lazy_base; k < arrlenu(design.ast.lazy); k++)
+                design.ast.lazy_paths[k] = units[i].path;
+            for (size_t k = lazy_tok_base; k < arrlenu(design.ast.lazy_offsets); k++)
+                design.ast.lazy_offsets[k] += chunk->begin;
+            for (uint32_t k = 0; k < ast_nkids(&design.ast, root); k++)
+                ast_push(&design.ast, ast_kid(&design.ast, root, k));
+            free_ast(&chunk->ast);
+            for (size_t d = 0; d < arrlenu(chunk->diags); d++) {
+                Diagnostic diag = chunk->diags[d];
+                diag.path = units[i].path;
+                diag.offset += chunk->begin;
+                arrput(design.diags, diag);
+            }
+            arrfree(chunk->diags);
+        }
+        arrfree(units[i].chunks);
+        free_buffer(&units[i].input);
+    }
+    design.ast.root = ast_finish(&design.ast, AST_ROOT, 0, mark);
+
+    for (int i = 0; i < nthreads; i++) {
+        design.memo_hits += ctxs[i].memo_hits;
+        add_parse_stats(&design.stats, &ctxs[i].stats);
+        if (ctxs[i].arena.peak > design.arena_peak)
+            design.arena_peak = ctxs[i].arena.peak;
+        free_parse_ctx(&ctxs[i]);
+        arrfree(remaps[i]);
+    }
+    free(remaps);
+    free(units);
+    free(ctxs);
+    return design;
+}
+
+// Appends the source files named in a filelist to paths. One entry per
+// line; blank lines and // or # comments are skipped, as are simulator
+// options such as +incdir+. "-f LIST" nests another filelist whose paths
+// are relative to the working directory, "-F LIST" one whose paths are
+// relative to LIST itself. Entries of this list are relative to rel_dir,
+// or to the working directory if it is NULL. reading holds the real paths
+// of the lists being read, outermost first, so that a list that nests
+// itself is an error rather than endless recursion.
+static void
+read_filelist_rel(const char * path, const char * rel_dir, char *** paths, char *** reading)
+{
+    Buffer list = read_file(path);
+    char * real = realpath(path, NULL);
+    if (real == NULL)
+        die("error: %s: cannot resolve path\n", path);
+    for (size_t i = 0; i < arrlenu(*reading); i++) {
+        if (!strcmp((*reading)[i], real))
+            die("error: filelist %s includes itself\n", path);
+    }
+    arrput(*reading, real);
+    char * p = list.p;
+    char * end = list.p + list.len;
+    while (p < end) {
+        char * line = p;
+        while (p < end && *p != '\n')
+            p++;
+        char * line_end = p++;
+        while (line < line_end && isspace((unsigned char) *line))
+            line++;
+        while (line_end > line && isspace((unsigned char) line_end[-1]))
+            line_end--;
+        if (line == line_end || *line == '#' || (line_end - line >= 2 && !memcmp(line, "//", 2)))
+            continue;
+
+        char nested = 0;
+        if (line_end - line > 3 && line[0] == '-' && (line[1] == 'f' || line[1] == 'F')
+                && isspace((unsigned char) line[2])) {
+            nested = line[1];
+            line += 3;
+            while (line < line_end && isspace((unsigned char) *line))
+                line++;
+        } else if (*line == '+' || *line == '-') {
+            continue;
+        }
+
+        char * entry = NULL;
+        if (rel_dir && *line != '/') {
+            memcpy(arraddnptr(entry, strlen(rel_dir)), rel_dir, strlen(rel_dir));
+            arrput(entry, '/');
+        }
+        memcpy(arraddnptr(entry, line_end - line), line, line_end - line);
+        arrput(entry, '\0');
+
+        if (nested == 'F') {
+            char * dir = strdup(entry);
+            char * slash = strrchr(dir, '/');
+            if (slash)
+                *slash = '\0';
+            read_filelist_rel(entry, slash ? dir : NULL, paths, reading);
+            free(dir);
+        } else if (nested == 'f') {
+            read_filelist_rel(entry, NULL, paths, reading);
+        } else {
+            arrput(*paths, strdup(entry));
+        }
+        arrfree(entry);
+    }
+    free(arrpop(*reading));
+    free_buffer(&list);
+}
+
+void
+read_filelist(const char * path, char *** paths)
+{
+    char ** reading = NULL;
+    read_filelist_rel(path, NULL, paths, &reading);
+    arrfree(reading);
+}
+
+void
+free_design(Design * design)
+{
+    free_ast(&design->ast);
+    free_symtab(&design->symtab);
+    arrfree(design->diags);
+}
@@ -0,0 +1,33 @@
+#ifndef DESIGN_H
+#define DESIGN_H
+
+// Many source files parsed in parallel and merged into one tree. Each
+// worker thread parses with its own ParseCtx, so its symbol table, memo
+// arena and node arrays are never shared; the per-file trees are then
+// appended to the design in the order the files were given, with their
+// symbols moved into the design's table. Large files are also cut at
+// module boundaries (see split.h) and their pieces parsed in parallel.
+typedef struct {
+    int nthreads;
+    bool use_memo;
+    bool lazy;
+    bool netlist;           // see Netlist in ast.h
+    const char * cache_dir; // AST cache directory, see cache.h; NULL for none
+} DesignOptions;
+
+typedef struct {
+    SymbolTable symtab;
+    Ast ast;                // AST_ROOT holding the modules of every file
+    Diagnostic * diags;     // stb_ds array, in file and offset order
+    size_t memo_hits;
+    ParseStats stats;       // of every worker
+    size_t arena_peak;      // largest memo arena of any worker
+    size_t cache_hits;      // inputs (files or pieces of files) taken from
+    size_t cache_lookups;   // the AST cache, out of those looked up
+} Design;
+
+Design parse_design(char ** paths, size_t npaths, const DesignOptions * opts);
+void read_filelist(const char * path, char *** paths);
+void free_design(Design * design);
+
+#endif /* DESIGN_H */
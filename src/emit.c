@@ -0,0 +1,788 @@
+#include "alloc.h"
+#include "stb_ds.h"
+#include "common.h"
+#include "symtab.h"
+#include "literal.h"
+#include "arena.h"
+#include "ast.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "emit.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+Emitter
+init_emitter(int fd, size_t cap)
+{
+    assert(cap >= 64);
+    Emitter e = {
+        .fd = fd,
+        .buf = malloc(cap),
+        .cap = cap,
+        .line_start = true,
+    };
+    assert(e.buf);
+    return e;
+}
+
+void
+flush_emitter(Emitter * e)
+{
+    if (e->fd < 0) {
+        // an in-memory emitter grows instead, see format_expr()
+        e->cap *= 2;
+        e->buf = realloc(e->buf, e->cap);
+        if (!e->buf)
+            die("error: out of memory for a %zu byte emitter buffer\n", e->cap);
+        return;
+    }
+    size_t done = 0;
+    while (done < e->len) {
+        ssize_t n = write(e->fd, e->buf + done, e->len - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            die("error: write: %s\n", strerror(errno));
+        }
+        done += n;
+    }
+    e->len = 0;
+}
+
+void
+free_emitter(Emitter * e)
+{
+    if (e->fd >= 0)
+        flush_emitter(e);
+    free(e->buf);
+    e->buf = NULL;
+    e->cap = 0;
+}
+
+static void
+put_bytes(Emitter * e, const char * s, size_t len)
+{
+    while (len > e->cap - e->len) {
+        size_t n = e->cap - e->len;
+        memcpy(e->buf + e->len, s, n);
+        e->len += n;
+        s += n;
+        len -= n;
+        flush_emitter(e);
+    }
+    memcpy(e->buf + e->len, s, len);
+    e->len += len;
+}
+
+static void
+put_indent(Emitter * e)
+{
+    static const char spaces[] = "                                ";
+    e->line_start = false;
+    for (size_t n = (size_t)e->indent * EMIT_INDENT; n;) {
+        size_t k = n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1;
+        put_bytes(e, spaces, k);
+        n -= k;
+    }
+}
+
+void
+emit_bytes(Emitter * e, const char * s, size_t len)
+{
+    if (e->line_start)
+        put_indent(e);
+    put_bytes(e, s, len);
+}
+
+void
+emit_str(Emitter * e, const char * s)
+{
+    emit_bytes(e, s, strlen(s));
+}
+
+void
+emit_char(Emitter * e, char c)
+{
+    if (e->line_start)
+        put_indent(e);
+    if (e->len == e->cap)
+        flush_emitter(e);
+    e->buf[e->len++] = c;
+}
+
+void
+emit_int(Emitter * e, int64_t x)
+{
+    char tmp[20];
+    char * p = tmp + sizeof(tmp);
+    // negate as unsigned so that INT64_MIN works
+    uint64_t u = x < 0 ? -(uint64_t)x : (uint64_t)x;
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (x < 0)
+        emit_char(e, '-');
+    emit_bytes(e, p, tmp + sizeof(tmp) - p);
+}
+
+void
+emit_newline(Emitter * e)
+{
+    if (e->len == e->cap)
+        flush_emitter(e);
+    e->buf[e->len++] = '\n';
+    e->line_start = true;
+}
+
+// Formats straight into the buffer. A literal that does not fit in what is
+// left gets a fresh buffer, and only one bigger than the whole buffer is
+// formatted on the heap.
+static void
+emit_literal(Emitter * e, const LiteralTable * lt, uint32_t index)
+{
+    if (e->line_start)
+        put_indent(e);
+    size_t len = format_literal(lt, index, e->buf + e->len, e->cap - e->len);
+    if (len < e->cap - e->len) {
+        e->len += len;
+        return;
+    }
+    flush_emitter(e);
+    if (len < e->cap - e->len) {
+        e->len += format_literal(lt, index, e->buf + e->len, e->cap - e->len);
+        return;
+    }
+    char * big = malloc(len + 1);
+    format_literal(lt, index, big, len + 1);
+    put_bytes(e, big, len);
+    free(big);
+}
+
+static const char * op_strs[] = {
+    [AST_BITWISE_OR]        = "|",
+    [AST_BITWISE_AND]       = "&",
+    [AST_BITWISE_XOR]       = "^",
+    [AST_BITWISE_XNOR]      = "~^",
+    [AST_BITWISE_INVERT]    = "~",
+    [AST_LOGICAL_AND]       = "&&",
+    [AST_LOGICAL_OR]        = "||",
+    [AST_LOGICAL_NOT]       = "!",
+    [AST_EQ]                = "==",
+    [AST_NEQ]               = "!=",
+    [AST_CASE_EQ]           = "===",
+    [AST_CASE_NEQ]          = "!==",
+    [AST_LT]                = "<",
+    [AST_LTE]               = "<=",
+    [AST_GT]                = ">",
+    [AST_GTE]               = ">=",
+    [AST_LSH]               = "<<",
+    [AST_RSH]               = ">>",
+    [AST_ALSH]              = "<<<",
+    [AST_ARSH]              = ">>>",
+    [AST_ADD]               = "+",
+    [AST_SUB]               = "-",
+    [AST_MUL]               = "*",
+    [AST_DIV]               = "/",
+    [AST_MOD]               = "%",
+    [AST_POW]               = "**",
+    [AST_UNARY_PLUS]        = "+",
+    [AST_UNARY_MINUS]       = "-",
+    [AST_REDUCE_AND]        = "&",
+    [AST_REDUCE_NAND]       = "~&",
+    [AST_REDUCE_OR]         = "|",
+    [AST_REDUCE_NOR]        = "~|",
+    [AST_REDUCE_XOR]        = "^",
+    [AST_REDUCE_XNOR]       = "~^",
+};
+
+static bool
+is_binary_op(AstNodeType type)
+{
+    return (type >= AST_BITWISE_OR && type <= AST_POW && type != AST_BITWISE_INVERT)
+        || type == AST_BITWISE_XNOR;
+}
+
+static bool
+is_unary_op(AstNodeType type)
+{
+    return type == AST_BITWISE_INVERT || (type >= AST_UNARY_PLUS && type <= AST_REDUCE_XNOR);
+}
+
+typedef struct {
+    Emitter * e;
+    const SymbolTable * symtab;
+    Diagnostic ** errors;   // NULL: drop them
+} EmitCtx;
+
+// Expands the body of a module about to be printed. A module whose body
+// does not parse is left out, as a full parse would have left it out,
+// and its error goes to ec->errors.
+static bool
+expand_or_report(EmitCtx * ec, Ast * ast, NodeId module_def)
+{
+    Diagnostic error;
+    if (expand_module_body(ast, module_def, &error))
+        return true;
+    if (ec->errors)
+        arrput(*ec->errors, error);
+    return false;
+}
+
+static void
+emit_name(EmitCtx * ec, const Ast * ast, NodeId id)
+{
+    emit_str(ec->e, sym_str(ec->symtab, ast_value(ast, id)));
+}
+
+// The statement under an always, initial, if or else: a block opens on the
+// header's line, anything else goes on the next line one level deeper.
+static void
+open_substmt(Emitter * e, const Ast * ast, NodeId stmt)
+{
+    if (ast_type(ast, stmt) == AST_BLOCK) {
+        emit_char(e, ' ');
+    } else {
+        emit_newline(e);
+        e->indent++;
+    }
+}
+
+static void
+close_substmt(Emitter * e, const Ast * ast, NodeId stmt)
+{
+    if (ast_type(ast, stmt) != AST_BLOCK)
+        e->indent--;
+}
+
+static void
+emit_net(EmitCtx * ec, const Net * net)
+{
+    emit_str(ec->e, sym_str(ec->symtab, net->name));
+    if (net->bit != NET_WHOLE) {
+        emit_char(ec->e, '[');
+        emit_int(ec->e, net->bit);
+        emit_char(ec->e, ']');
+    }
+}
+
+// The instances of a netlist body, after its other items.
+static void
+emit_cells(EmitCtx * ec, const Ast * ast, NodeId body)
+{
+    Emitter * e = ec->e;
+    const Netlist * nl = &ast->netlist;
+    NetlistBody nb = nl->bodies[ast_value(ast, body)];
+    for (uint32_t c = nb.cell_begin; c < nb.cell_end; c++) {
+        emit_str(e, sym_str(ec->symtab, nl->cells[c].type));
+        emit_char(e, ' ');
+        emit_str(e, sym_str(ec->symtab, nl->cells[c].name));
+        emit_char(e, '(');
+        emit_newline(e);
+        e->indent++;
+        uint32_t end = cell_pins_end(nl, c);
+        for (uint32_t p = nl->cells[c].pins; p < end; p++) {
+            emit_char(e, '.');
+            emit_str(e, sym_str(ec->symtab, nl->pin_names[p]));
+            emit_char(e, '(');
+            if (nl->pin_nets[p] != NET_NONE)
+                emit_net(ec, &nl->nets[nl->pin_nets[p]]);
+            emit_char(e, ')');
+            if (p + 1 < end)
+                emit_char(e, ',');
+            emit_newline(e);
+        }
+        e->indent--;
+        emit_str(e, ");");
+        emit_newline(e);
+    }
+}
+
+static void
+emit_enter(void * user, Ast * ast, NodeId id)
+{
+    EmitCtx * ec = user;
+    Emitter * e = ec->e;
+    AstNodeType type = ast_type(ast, id);
+    switch (type) {
+        case AST_ROOT:
+        case AST_MODULE_BODY:
+        case AST_NETLIST_BODY:
+        case AST_PORT_LIST:
+        case AST_PARAM_LIST:
+        case AST_PORT_MAP_LIST:
+        case AST_INSTANTIATION:
+        case AST_NON_BLOCKING:
+        case AST_BLOCKING:
+        case AST_TERNARY:
+        case AST_INDEX:
+            break;
+        case AST_MODULE_DEF:
+            emit_str(e, "module ");
+            emit_name(ec, ast, id);
+            emit_str(e, " (");
+            emit_newline(e);
+            e->indent++;
+            break;
+        case AST_BITRANGE:
+            emit_char(e, '[');
+            break;
+        case AST_NUMBER:
+            // not ast_number(): an unsized number may not fit in 64 bits
+            emit_literal(e, &ast->literals, ast_value(ast, id));
+            break;
+        case AST_INPUT:
+            emit_str(e, "input ");
+            break;
+        case AST_OUTPUT:
+            emit_str(e, "output ");
+            break;
+        case AST_PORT_MAP:
+            emit_char(e, '.');
+            break;
+        case AST_CONT_ASSIGN:
+            emit_str(e, "assign ");
+            break;
+        case AST_ALWAYS:
+            emit_str(e, "always ");
+            break;
+        case AST_SENSITIVITY_LIST:
+            emit_str(e, "@(");
+            break;
+        case AST_INITIAL:
+            emit_str(e, "initial");
+            break;
+        case AST_IF:
+            emit_str(e, "if (");
+            break;
+        case AST_DPI:
+            emit_char(e, '$');
+            emit_name(ec, ast, id);
+            emit_str(e, "();");
+            emit_newline(e);
+            break;
+        case AST_WIRE_DECL:
+            emit_str(e, "wire ");
+            break;
+        case AST_REG_DECL:
+            emit_str(e, "reg ");
+            break;
+        case AST_IDENT:
+            emit_name(ec, ast, id);
+            break;
+        case AST_BITWISE_INVERT:
+        case AST_LOGICAL_NOT:
+        case AST_UNARY_PLUS:
+        case AST_UNARY_MINUS:
+        case AST_REDUCE_AND:
+        case AST_REDUCE_NAND:
+        case AST_REDUCE_OR:
+        case AST_REDUCE_NOR:
+        case AST_REDUCE_XOR:
+        case AST_REDUCE_XNOR:
+            emit_str(e, op_strs[type]);
+            // keep & &a from printing as &&a, and ~ &a as ~&a
+            if (is_unary_op(ast_type(ast, ast_kid(ast, id, 0))))
+                emit_char(e, ' ');
+            break;
+        case AST_PAREN:
+            emit_char(e, '(');
+            break;
+        case AST_CONCAT:
+            emit_char(e, '{');
+            break;
+        case AST_LITERAL:
+            emit_literal(e, &ast->literals, ast_value(ast, id));
+            break;
+        case AST_DELAY:
+            emit_char(e, '#');
+            emit_literal(e, &ast->literals, ast_value(ast, id));
+            emit_newline(e);
+            break;
+        case AST_BLOCK:
+            emit_str(e, "begin");
+            emit_newline(e);
+            e->indent++;
+            break;
+        default:
+            assert(is_binary_op(type));
+            break;
+    }
+}
+
+// Separators, and a few names that go between children.
+static bool
+emit_kid(void * user, Ast * ast, NodeId id, uint32_t i)
+{
+    EmitCtx * ec = user;
+    Emitter * e = ec->e;
+    AstNodeType type = ast_type(ast, id);
+    NodeId kid = ast_kid(ast, id, i);
+    switch (type) {
+        case AST_ROOT:
+            return expand_or_report(ec, ast, kid);
+        case AST_MODULE_DEF:
+            if (i == 2) {
+                e->indent--;
+                emit_str(e, ");");
+                emit_newline(e);
+                e->indent++;
+            }
+            break;
+        case AST_PORT_LIST:
+        case AST_PORT_MAP_LIST:
+            if (i > 0) {
+                emit_char(e, ',');
+                emit_newline(e);
+            }
+            break;
+        case AST_BITRANGE:
+            if (i > 0)
+                emit_char(e, ':');
+            break;
+        case AST_INSTANTIATION:
+            if (i == 1) {
+                emit_char(e, ' ');
+            } else if (i == 2) {
+                emit_char(e, '(');
+                emit_newline(e);
+                e->indent++;
+            }
+            break;
+        case AST_PORT_MAP:
+            if (i == 1)
+                emit_char(e, '(');
+            break;
+        case AST_CONT_ASSIGN:
+        case AST_BLOCKING:
+            if (i == 1)
+                emit_str(e, " = ");
+            break;
+        case AST_NON_BLOCKING:
+            if (i == 1)
+                emit_str(e, " <= ");
+            break;
+        case AST_ALWAYS:
+            if (i == 1)
+                open_substmt(e, ast, kid);
+            break;
+        case AST_SENSITIVITY_LIST:
+            if (i > 0)
+                emit_str(e, " or ");
+            break;
+        case AST_INITIAL:
+            if (i > 0)
+                close_substmt(e, ast, ast_kid(ast, id, i - 1));
+            open_substmt(e, ast, kid);
+            break;
+        case AST_IF:
+            if (i == 1) {
+                emit_char(e, ')');
+                open_substmt(e, ast, kid);
+            } else if (i == 2 && kid) {
+                close_substmt(e, ast, ast_kid(ast, id, 1));
+                emit_str(e, "else");
+                open_substmt(e, ast, kid);
+            }
+            break;
+        case AST_WIRE_DECL:
+        case AST_REG_DECL:
+            // the name goes between the packed and the unpacked ranges
+            if (i == 1) {
+                if (ast_kid(ast, id, 0))
+                    emit_char(e, ' ');
+                emit_name(ec, ast, id);
+            }
+            if (i >= 1)
+                emit_char(e, ' ');
+            break;
+        case AST_TERNARY:
+            if (i > 0)
+                emit_str(e, i == 1 ? " ? " : " : ");
+            break;
+        case AST_INDEX:
+            if (i == 1)
+                emit_char(e, '[');
+            break;
+        case AST_CONCAT:
+            if (i > 0)
+                emit_str(e, ", ");
+            break;
+        default:
+            if (is_binary_op(type) && i == 1) {
+                emit_char(e, ' ');
+                emit_str(e, op_strs[type]);
+                emit_char(e, ' ');
+            }
+            break;
+    }
+    return true;
+}
+
+static void
+emit_leave(void * user, Ast * ast, NodeId id)
+{
+    EmitCtx * ec = user;
+    Emitter * e = ec->e;
+    switch (ast_type(ast, id)) {
+        case AST_MODULE_DEF:
+            e->indent--;
+            emit_str(e, "endmodule");
+            emit_newline(e);
+            emit_newline(e);
+            break;
+        case AST_PORT_LIST:
+        case AST_PORT_MAP_LIST:
+            if (ast_nkids(ast, id))
+                emit_newline(e);
+            break;
+        case AST_BITRANGE:
+        case AST_INDEX:
+            emit_char(e, ']');
+            break;
+        case AST_INPUT:
+        case AST_OUTPUT:
+            if (ast_nkids(ast, id) && ast_kid(ast, id, 0))
+                emit_char(e, ' ');
+            emit_name(ec, ast, id);
+            break;
+        case AST_INSTANTIATION:
+            e->indent--;
+            emit_str(e, ");");
+            emit_newline(e);
+            break;
+        case AST_PORT_MAP:
+        case AST_PAREN:
+        case AST_SENSITIVITY_LIST:
+            emit_char(e, ')');
+            break;
+        case AST_CONT_ASSIGN:
+        case AST_NON_BLOCKING:
+        case AST_BLOCKING:
+            emit_char(e, ';');
+            emit_newline(e);
+            break;
+        case AST_ALWAYS:
+            close_substmt(e, ast, ast_kid(ast, id, 1));
+            break;
+        case AST_INITIAL:
+            if (ast_nkids(ast, id))
+                close_substmt(e, ast, ast_kid(ast, id, ast_nkids(ast, id) - 1));
+            break;
+        case AST_IF: {
+                NodeId last = ast_nkids(ast, id) > 2 && ast_kid(ast, id, 2) ? ast_kid(ast, id, 2) : ast_kid(ast, id, 1);
+                close_substmt(e, ast, last);
+            }
+            break;
+        case AST_WIRE_DECL:
+        case AST_REG_DECL:
+            if (ast_nkids(ast, id) == 1) {
+                if (ast_kid(ast, id, 0))
+                    emit_char(e, ' ');
+                emit_name(ec, ast, id);
+            }
+            emit_char(e, ';');
+            emit_newline(e);
+            break;
+        case AST_CONCAT:
+            emit_char(e, '}');
+            break;
+        case AST_BLOCK:
+            e->indent--;
+            emit_str(e, "end");
+            emit_newline(e);
+            break;
+        case AST_NETLIST_BODY:
+            emit_cells(ec, ast, id);
+            break;
+        default:
+            break;
+    }
+}
+
+void
+emit_verilog(Emitter * e, Ast * ast, const SymbolTable * symtab, Diagnostic ** errors)
+{
+    EmitCtx ec = { .e = e, .symtab = symtab, .errors = errors };
+    AstVisitor visitor = {
+        .enter = emit_enter,
+        .kid = emit_kid,
+        .leave = emit_leave,
+    };
+    ast_walk(ast, ast->root, &visitor, &ec);
+}
+
+// Formats the expression under id like snprintf(): writes as much of it as
+// fits in cap - 1 bytes and a NUL to out, and returns its full length.
+size_t
+format_expr(Ast * ast, const SymbolTable * symtab, NodeId id, char * out, size_t cap)
+{
+    Emitter e = init_emitter(-1, 64);
+    EmitCtx ec = { .e = &e, .symtab = symtab };
+    AstVisitor visitor = {
+        .enter = emit_enter,
+        .kid = emit_kid,
+        .leave = emit_leave,
+    };
+    ast_walk(ast, id, &visitor, &ec);
+    if (cap) {
+        size_t n = e.len < cap - 1 ? e.len : cap - 1;
+        memcpy(out, e.buf, n);
+        out[n] = '\0';
+    }
+    size_t len = e.len;
+    free_emitter(&e);
+    return len;
+}
+
+// --emit=json: JSON Lines, one module per line, so that the output is the
+// same whether or not the design was parsed in one piece. A node is
+//
+//     {"type": "module_def", "name": "top", "kids": [null, {...}, {...}]}
+//
+// with "name" for nodes that hold a symbol, "text" for literals and
+// numbers as written, and null for an absent child. A netlist body also
+// has "cells", each {"type", "name", "pins": [{"pin", "net", "bit"}]}.
+// Strings are escaped on the way into the buffer; nothing is formatted
+// anywhere else first.
+
+static void
+emit_json_str(Emitter * e, const char * s)
+{
+    static const char hex[] = "0123456789abcdef";
+    emit_char(e, '"');
+    const char * run = s;
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        emit_bytes(e, run, s - run);
+        emit_char(e, '\\');
+        if (c == '"' || c == '\\') {
+            emit_char(e, c);
+        } else {
+            emit_str(e, "u00");
+            emit_char(e, hex[c >> 4]);
+            emit_char(e, hex[c & 15]);
+        }
+        run = s + 1;
+    }
+    emit_bytes(e, run, s - run);
+    emit_char(e, '"');
+}
+
+static void
+emit_json_sym(EmitCtx * ec, Symbol sym)
+{
+    emit_json_str(ec->e, sym_str(ec->symtab, sym));
+}
+
+static void
+emit_json_cells(EmitCtx * ec, const Ast * ast, NodeId body)
+{
+    Emitter * e = ec->e;
+    const Netlist * nl = &ast->netlist;
+    NetlistBody nb = nl->bodies[ast_value(ast, body)];
+    emit_str(e, ",\"cells\":[");
+    for (uint32_t c = nb.cell_begin; c < nb.cell_end; c++) {
+        if (c > nb.cell_begin)
+            emit_char(e, ',');
+        emit_str(e, "{\"type\":");
+        emit_json_sym(ec, nl->cells[c].type);
+        emit_str(e, ",\"name\":");
+        emit_json_sym(ec, nl->cells[c].name);
+        emit_str(e, ",\"pins\":[");
+        uint32_t end = cell_pins_end(nl, c);
+        for (uint32_t p = nl->cells[c].pins; p < end; p++) {
+            if (p > nl->cells[c].pins)
+                emit_char(e, ',');
+            emit_str(e, "{\"pin\":");
+            emit_json_sym(ec, nl->pin_names[p]);
+            emit_str(e, ",\"net\":");
+            if (nl->pin_nets[p] == NET_NONE) {
+                emit_str(e, "null");
+            } else {
+                const Net * net = &nl->nets[nl->pin_nets[p]];
+                emit_json_sym(ec, net->name);
+                if (net->bit != NET_WHOLE) {
+                    emit_str(e, ",\"bit\":");
+                    emit_int(e, net->bit);
+                }
+            }
+            emit_char(e, '}');
+        }
+        emit_str(e, "]}");
+    }
+    emit_char(e, ']');
+}
+
+static void
+json_enter(void * user, Ast * ast, NodeId id)
+{
+    EmitCtx * ec = user;
+    Emitter * e = ec->e;
+    AstNodeType type = ast_type(ast, id);
+    emit_str(e, "{\"type\":\"");
+    emit_str(e, ast_type_name(type));
+    emit_char(e, '"');
+    switch (ast_value_kind(type)) {
+        case VALUE_SYMBOL:
+            emit_str(e, ",\"name\":");
+            emit_json_sym(ec, ast_value(ast, id));
+            break;
+        case VALUE_LITERAL:
+            // literal text is digits, letters and ', so needs no escaping
+            emit_str(e, ",\"text\":\"");
+            emit_literal(e, &ast->literals, ast_value(ast, id));
+            emit_char(e, '"');
+            break;
+        default:
+            break;
+    }
+    emit_str(e, ",\"kids\":[");
+}
+
+static bool
+json_kid(void * user, Ast * ast, NodeId id, uint32_t i)
+{
+    EmitCtx * ec = user;
+    if (i > 0)
+        emit_char(ec->e, ',');
+    NodeId kid = ast_kid(ast, id, i);
+    if (!kid) {
+        emit_str(ec->e, "null");
+        return false;
+    }
+    return true;
+}
+
+static void
+json_leave(void * user, Ast * ast, NodeId id)
+{
+    EmitCtx * ec = user;
+    emit_char(ec->e, ']');
+    if (ast_type(ast, id) == AST_NETLIST_BODY)
+        emit_json_cells(ec, ast, id);
+    emit_char(ec->e, '}');
+}
+
+void
+emit_json(Emitter * e, Ast * ast, const SymbolTable * symtab, Diagnostic ** errors)
+{
+    EmitCtx ec = { .e = e, .symtab = symtab, .errors = errors };
+    AstVisitor visitor = {
+        .enter = json_enter,
+        .kid = json_kid,
+        .leave = json_leave,
+    };
+    for (uint32_t i = 0; i < ast_nkids(ast, ast->root); i++) {
+        NodeId module_def = ast_kid(ast, ast->root, i);
+        if (!expand_or_report(&ec, ast, module_def))
+            continue;
+        ast_walk(ast, module_def, &visitor, &ec);
+        emit_newline(e);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef EMIT_H
+#define EMIT_H
+
+// Buffered output. Appends are copied into one large buffer that goes out
+// in a single write() whenever it fills up, so a fragment costs a memcpy
+// rather than a stdio call, and nothing is allocated after init_emitter().
+// Fragments never contain a newline: emit_newline() ends the line, and the
+// first append on the next line writes the indentation.
+typedef struct {
+    int fd;                 // -1: keep everything in buf, which grows
+    char * buf;
+    size_t len;
+    size_t cap;
+    int indent;             // in levels of EMIT_INDENT spaces
+    bool line_start;
+} Emitter;
+
+#define EMIT_INDENT 4
+
+Emitter init_emitter(int fd, size_t cap);
+void emit_bytes(Emitter * e, const char * s, size_t len);
+void emit_str(Emitter * e, const char * s);
+void emit_char(Emitter * e, char c);
+void emit_int(Emitter * e, int64_t x);
+void emit_newline(Emitter * e);
+void flush_emitter(Emitter * e);
+void free_emitter(Emitter * e);
+
+// Lazy bodies are expanded as they are reached. A module whose body does
+// not parse is left out, and its error appended to *errors unless errors
+// is NULL.
+void emit_verilog(Emitter * e, Ast * ast, const SymbolTable * symtab, Diagnostic ** errors);
+void emit_json(Emitter * e, Ast * ast, const SymbolTable * symtab, Diagnostic ** errors);
+size_t format_expr(Ast * ast, const SymbolTable * symtab, NodeId id, char * out, size_t cap);
+
+#endif /* EMIT_H */
@@ -0,0 +1,529 @@
+#include "alloc.h"
+#include "stb_ds.h"
+#include "common.h"
+#include "literal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LITERAL_MAX_WIDTH (1u << 24)
+
+#define ONES  0x0101010101010101ull
+#define HIGHS 0x8080808080808080ull
+
+static size_t
+num_words(size_t width)
+{
+    return (width + 63) / 64;
+}
+
+// ORs the nbits wide value into words at bit pos.
+static void
+or_bits(uint64_t * words, size_t pos, uint64_t value, unsigned nbits)
+{
+    unsigned shift = pos % 64;
+    words[pos / 64] |= value << shift;
+    if (shift && shift + nbits > 64)
+        words[pos / 64 + 1] |= value >> (64 - shift);
+}
+
+static uint64_t
+get_bits(const uint64_t * words, size_t pos, unsigned nbits)
+{
+    unsigned shift = pos % 64;
+    uint64_t v = words[pos / 64] >> shift;
+    if (shift && shift + nbits > 64)
+        v |= words[pos / 64 + 1] << (64 - shift);
+    return nbits == 64 ? v : v & ((1ull << nbits) - 1);
+}
+
+// Sets bits [from, to).
+static void
+fill_bits(uint64_t * words, size_t from, size_t to)
+{
+    for (size_t pos = from; pos < to; ) {
+        unsigned n = 64 - pos % 64;
+        if (n > to - pos)
+            n = to - pos;
+        or_bits(words, pos, n == 64 ? ~0ull : (1ull << n) - 1, n);
+        pos += n;
+    }
+}
+
+// Clears everything from bit width up to the end of the last word.
+static void
+truncate_bits(uint64_t * words, size_t nwords, size_t width)
+{
+    size_t keep = num_words(width);
+    if (width % 64)
+        words[keep - 1] &= (1ull << (width % 64)) - 1;
+    memset(words + keep, 0, (nwords - keep) * sizeof(*words));
+}
+
+// The block decoders below look at 8 digit characters at once. Each
+// returns false if any of them is not a plain digit of its base (x, z, ?
+// or _), in which case the caller falls back to one digit at a time.
+
+// Top bit set in every byte of w that lies outside [lo, hi].
+static uint64_t
+bytes_outside(uint64_t w, unsigned lo, unsigned hi)
+{
+    uint64_t above = w + ONES * (127 - hi);
+    uint64_t below = ~((w | HIGHS) - ONES * lo);
+    return (above | below | w) & HIGHS;
+}
+
+static uint64_t
+load8(const char * p)
+{
+    uint64_t w;
+    memcpy(&w, p, 8);
+    return w;
+}
+
+// "0123abcd" -> 0x0123abcd
+static bool
+decode_hex8(const char * p, uint64_t * value)
+{
+    uint64_t w = load8(p);
+    uint64_t lower = w | (ONES * 0x20);
+    if (bytes_outside(lower, '0', '9') & bytes_outside(lower, 'a', 'f'))
+        return false;
+    // '0'-'9' keep their low nibble, letters add 9 to theirs
+    uint64_t x = (w & (ONES * 0x0f)) + ((w >> 6) & ONES) * 9;
+    x = __builtin_bswap64(x);
+    x = (x | (x >> 4))  & 0x00ff00ff00ff00ffull;
+    x = (x | (x >> 8))  & 0x0000ffff0000ffffull;
+    x = (x | (x >> 16)) & 0x00000000ffffffffull;
+    *value = x;
+    return true;
+}
+
+// "01100001" -> 0x61
+static bool
+decode_bin8(const char * p, uint64_t * value)
+{
+    uint64_t w = load8(p);
+    if (bytes_outside(w, '0', '1'))
+        return false;
+    *value = (__builtin_bswap64(w & ONES) * 0x0102040810204080ull) >> 56;
+    return true;
+}
+
+// "12345678" -> 12345678
+static bool
+decode_dec8(const char * p, uint64_t * value)
+{
+    uint64_t w = load8(p);
+    if (bytes_outside(w, '0', '9'))
+        return false;
+    w = ((w & (ONES * 0x0f)) * 2561) >> 8;
+    w = ((w & 0x00ff00ff00ff00ffull) * 6553601) >> 16;
+    *value = ((w & 0x0000ffff0000ffffull) * 42949672960001ull) >> 32;
+    return true;
+}
+
+// words = words * mul + add
+static void
+mul_add(uint64_t * words, size_t nwords, uint64_t mul, uint64_t add)
+{
+    unsigned __int128 carry = add;
+    for (size_t i = 0; i < nwords; i++) {
+        carry += (unsigned __int128) words[i] * mul;
+        words[i] = (uint64_t) carry;
+        carry >>= 64;
+    }
+}
+
+// words = words / div, returns the remainder
+static uint64_t
+div_rem(uint64_t * words, size_t nwords, uint64_t div)
+{
+    unsigned __int128 rem = 0;
+    for (size_t i = nwords; i-- > 0; ) {
+        rem = (rem << 64) | words[i];
+        words[i] = (uint64_t) (rem / div);
+        rem %= div;
+    }
+    return (uint64_t) rem;
+}
+
+static size_t
+bit_length(const uint64_t * words, size_t nwords)
+{
+    for (size_t i = nwords; i-- > 0; )
+        if (words[i])
+            return i * 64 + 64 - __builtin_clzll(words[i]);
+    return 0;
+}
+
+static int
+digit_bits(int base)
+{
+    return base == 2 ? 1 : base == 8 ? 3 : 4;
+}
+
+static bool
+is_x(char c)
+{
+    return c == 'x' || c == 'X';
+}
+
+static bool
+is_z(char c)
+{
+    return c == 'z' || c == 'Z' || c == '?';
+}
+
+// Binary, octal and hex digits, least significant first. Returns the
+// number of bits written and the most significant digit seen.
+static size_t
+decode_based(const char * digits, const char * end, int base, uint64_t * aval, uint64_t * bval, char * msd)
+{
+    int k = digit_bits(base);
+    size_t pos = 0;
+    const char * p = end;
+    while (p > digits) {
+        uint64_t v;
+        if (p - digits >= 8 && base == 16 && decode_hex8(p - 8, &v)) {
+            or_bits(aval, pos, v, 32);
+            pos += 32;
+            p -= 8;
+            *msd = *p;
+            continue;
+        }
+        if (p - digits >= 8 && base == 2 && decode_bin8(p - 8, &v)) {
+            or_bits(aval, pos, v, 8);
+            pos += 8;
+            p -= 8;
+            *msd = *p;
+            continue;
+        }
+        char c = *--p;
+        if (c == '_')
+            continue;
+        uint64_t ones = (1u << k) - 1;
+        if (is_x(c)) {
+            or_bits(aval, pos, ones, k);
+            or_bits(bval, pos, ones, k);
+        } else if (is_z(c)) {
+            or_bits(bval, pos, ones, k);
+        } else {
+            v = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+            or_bits(aval, pos, v, k);
+        }
+        pos += k;
+        *msd = c;
+    }
+    return pos;
+}
+
+// Decimal digits, most significant first. A decimal literal is either a
+// number or a single x or z digit, which then stands for every bit.
+static void
+decode_decimal(const char * digits, const char * end, uint64_t * aval, uint64_t * bval, size_t nwords, char * xz)
+{
+    const char * p = digits;
+    while (p < end) {
+        uint64_t v;
+        if (end - p >= 8 && decode_dec8(p, &v)) {
+            mul_add(aval, nwords, 100000000, v);
+            p += 8;
+            continue;
+        }
+        char c = *p++;
+        if (c == '_')
+            continue;
+        if (is_x(c) || is_z(c)) {
+            memset(aval, 0, nwords * sizeof(*aval));
+            memset(bval, 0, nwords * sizeof(*bval));
+            *xz = c;
+            return;
+        }
+        mul_add(aval, nwords, 10, c - '0');
+    }
+}
+
+uint32_t
+decode_literal(LiteralTable * lt, const char * s, size_t len)
+{
+    const char * end = s + len;
+    const char * tick = memchr(s, '\'', len);
+    Literal lit = { .width = 32, .base = 10 };
+    const char * digits = s;
+    if (tick == NULL) {
+        lit.flags |= LIT_SIGNED;
+    } else {
+        lit.flags |= LIT_BASED;
+        if (tick > s) {
+            size_t width = 0;
+            for (const char * p = s; p < tick; p++)
+                if (*p != '_' && width <= LITERAL_MAX_WIDTH)
+                    width = width * 10 + (*p - '0');
+            if (width == 0)
+                width = 1;
+            if (width > LITERAL_MAX_WIDTH)
+                width = LITERAL_MAX_WIDTH;
+            lit.width = width;
+            lit.flags |= LIT_SIZED;
+        }
+        const char * p = tick + 1;
+        if (p < end && (*p == 's' || *p == 'S')) {
+            lit.flags |= LIT_SIGNED;
+            p++;
+        }
+        char c = p < end ? *p | 0x20 : 'd';
+        lit.base = c == 'b' ? 2 : c == 'o' ? 8 : c == 'h' ? 16 : 10;
+        digits = p + 1 < end ? p + 1 : end;
+    }
+
+    // room for every digit as well as for the declared width, plus one
+    // word so that or_bits() may always touch the word after pos
+    size_t ndigits = end - digits;
+    size_t bits = ndigits * digit_bits(lit.base);
+    if (bits < lit.width)
+        bits = lit.width;
+    size_t nwords = num_words(bits) + 1;
+    uint64_t small[8] = {0};
+    uint64_t * aval = nwords <= 4 ? small : calloc(2 * nwords, sizeof(*aval));
+    if (aval == NULL)
+        die("error: out of memory for literal\n");
+    uint64_t * bval = aval + nwords;
+
+    char msd = 0;
+    if (lit.base == 10) {
+        decode_decimal(digits, end, aval, bval, nwords, &msd);
+        if (!(lit.flags & LIT_SIZED)) {
+            // keep room for the sign bit so big plain numbers stay positive
+            size_t used = bit_length(aval, nwords) + !!(lit.flags & LIT_SIGNED);
+            if (used > lit.width)
+                lit.width = used;
+        }
+        if (msd)
+            fill_bits(bval, 0, lit.width);
+        if (is_x(msd))
+            fill_bits(aval, 0, lit.width);
+    } else {
+        size_t used = decode_based(digits, end, lit.base, aval, bval, &msd);
+        if (!(lit.flags & LIT_SIZED) && used > lit.width)
+            lit.width = used;
+        // x and z in the leftmost digit extend to the full width
+        if (used < lit.width && (is_x(msd) || is_z(msd))) {
+            fill_bits(bval, used, lit.width);
+            if (is_x(msd))
+                fill_bits(aval, used, lit.width);
+        }
+    }
+    truncate_bits(aval, nwords, lit.width);
+    truncate_bits(bval, nwords, lit.width);
+    for (size_t i = 0; i < nwords; i++)
+        if (bval[i])
+            lit.flags |= LIT_XZ;
+
+    if (lit.width <= 64) {
+        lit.aval = aval[0];
+        lit.bval = bval[0];
+    } else {
+        size_t n = num_words(lit.width);
+        lit.word_offset = arrlenu(lt->words);
+        memcpy(arraddnptr(lt->words, n), aval, n * sizeof(*aval));
+        memcpy(arraddnptr(lt->words, n), bval, n * sizeof(*bval));
+    }
+    if (aval != small)
+        free(aval);
+    arrput(lt->lits, lit);
+    return arrlenu(lt->lits) - 1;
+}
+
+const Literal *
+literal_at(const LiteralTable * lt, uint32_t index)
+{
+    return &lt->lits[index];
+}
+
+const uint64_t *
+literal_aval(const LiteralTable * lt, const Literal * lit)
+{
+    return lit->width <= 64 ? &lit->aval : &lt->words[lit->word_offset];
+}
+
+const uint64_t *
+literal_bval(const LiteralTable * lt, const Literal * lit)
+{
+    return lit->width <= 64 ? &lit->bval : &lt->words[lit->word_offset + num_words(lit->width)];
+}
+
+// The low 64 bits, sign-extended for signed literals. x and z read as 0.
+int64_t
+literal_int64(const LiteralTable * lt, uint32_t index)
+{
+    const Literal * lit = literal_at(lt, index);
+    uint64_t v = literal_aval(lt, lit)[0] & ~literal_bval(lt, lit)[0];
+    if ((lit->flags & LIT_SIGNED) && lit->width < 64 && (v >> (lit->width - 1) & 1))
+        v |= ~0ull << lit->width;
+    return (int64_t) v;
+}
+
+typedef struct {
+    char * p;
+    size_t cap;
+    size_t len;
+} Output;
+
+static void
+put_char(Output * out, char c)
+{
+    if (out->len + 1 < out->cap)
+        out->p[out->len] = c;
+    out->len++;
+}
+
+static void
+put_uint(Output * out, uint64_t v)
+{
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n)
+        put_char(out, digits[--n]);
+}
+
+// One digit of k bits at pos, or 0 if it mixes known and unknown bits.
+static char
+digit_char(const uint64_t * aval, const uint64_t * bval, size_t pos, unsigned k)
+{
+    uint64_t ones = (1u << k) - 1;
+    uint64_t a = get_bits(aval, pos, k);
+    uint64_t b = get_bits(bval, pos, k);
+    if (b == 0)
+        return "0123456789abcdef"[a];
+    if (b != ones || (a != 0 && a != ones))
+        return 0;
+    return a ? 'x' : 'z';
+}
+
+static void
+put_based(Output * out, const uint64_t * aval, const uint64_t * bval, uint32_t width, int base)
+{
+    unsigned k = digit_bits(base);
+    size_t ndigits = (width + k - 1) / k;
+    bool leading = true;
+    for (size_t i = ndigits; i-- > 0; ) {
+        size_t pos = i * k;
+        unsigned n = pos + k > width ? width - pos : k;
+        char c = digit_char(aval, bval, pos, n);
+        if (leading && c == '0' && i > 0)
+            continue;
+        // a leading x or z would extend over the zeros that were dropped
+        if (leading && (c == 'x' || c == 'z') && i + 1 < ndigits)
+            put_char(out, '0');
+        leading = false;
+        put_char(out, c);
+    }
+}
+
+static void
+put_decimal(Output * out, const uint64_t * aval, uint32_t width)
+{
+    size_t nwords = num_words(width);
+    if (nwords == 1) {
+        put_uint(out, aval[0]);
+        return;
+    }
+    // peel off 19 digits at a time, least significant chunk first
+    uint64_t * tmp = malloc(nwords * sizeof(*tmp));
+    uint64_t * chunks = NULL;
+    if (tmp == NULL)
+        die("error: out of memory for literal\n");
+    memcpy(tmp, aval, nwords * sizeof(*tmp));
+    do {
+        arrput(chunks, div_rem(tmp, nwords, 10000000000000000000ull));
+    } while (bit_length(tmp, nwords));
+    put_uint(out, arrlast(chunks));
+    for (size_t i = arrlenu(chunks) - 1; i-- > 0; ) {
+        char digits[20];
+        uint64_t v = chunks[i];
+        for (int j = 18; j >= 0; j--, v /= 10)
+            digits[j] = '0' + v % 10;
+        for (int j = 0; j < 19; j++)
+            put_char(out, digits[j]);
+    }
+    arrfree(chunks);
+    free(tmp);
+}
+
+// Writes the literal back as Verilog source, e.g. 8'hff or 'sd5, snprintf
+// style: at most cap - 1 characters plus a NUL, returning the full length.
+size_t
+format_literal(const LiteralTable * lt, uint32_t index, char * p, size_t cap)
+{
+    const Literal * lit = literal_at(lt, index);
+    const uint64_t * aval = literal_aval(lt, lit);
+    const uint64_t * bval = literal_bval(lt, lit);
+    Output out = { .p = p, .cap = cap };
+
+    int base = lit->base;
+    if (base != 10 && (lit->flags & LIT_XZ)) {
+        // octal or hex digits that are only partly x or z need binary
+        unsigned k = digit_bits(base);
+        for (size_t pos = 0; pos < lit->width && base != 2; pos += k) {
+            unsigned n = pos + k > lit->width ? lit->width - pos : k;
+            if (!digit_char(aval, bval, pos, n))
+                base = 2;
+        }
+    }
+
+    if (lit->flags & LIT_SIZED)
+        put_uint(&out, lit->width);
+    if (lit->flags & LIT_BASED) {
+        put_char(&out, '\'');
+        if (lit->flags & LIT_SIGNED)
+            put_char(&out, 's');
+        put_char(&out, base == 2 ? 'b' : base == 8 ? 'o' : base == 16 ? 'h' : 'd');
+    }
+    if (base != 10)
+        put_based(&out, aval, bval, lit->width, base);
+    else if (lit->flags & LIT_XZ)
+        put_char(&out, aval[0] & 1 ? 'x' : 'z');
+    else
+        put_decimal(&out, aval, lit->width);
+
+    if (cap)
+        p[out.len < cap ? out.len : cap - 1] = '\0';
+    return out.len;
+}
+
+// Appends the literals of src to dst and returns the index the first of
+// them has in dst.
+uint32_t
+append_literals(LiteralTable * dst, const LiteralTable * src)
+{
+    uint32_t lit_base = arrlenu(dst->lits);
+    size_t word_base = arrlenu(dst->words);
+    for (size_t i = 0; i < arrlenu(src->lits); i++) {
+        Literal lit = src->lits[i];
+        if (lit.width > 64)
+            lit.word_offset += word_base;
+        arrput(dst->lits, lit);
+    }
+    size_t nwords = arrlenu(src->words);
+    if (nwords)
+        memcpy(arraddnptr(dst->words, nwords), src->words, nwords * sizeof(*src->words));
+    return lit_base;
+}
+
+void
+clear_literals(LiteralTable * lt)
+{
+    arrsetlen(lt->lits, 0);
+    arrsetlen(lt->words, 0);
+}
+
+void
+free_literals(LiteralTable * lt)
+{
+    arrfree(lt->lits);
+    arrfree(lt->words);
+}
@@ -0,0 +1,43 @@
+#ifndef LITERAL_H
+#define LITERAL_H
+
+// Verilog numbers, decoded once by the tokenizer. Every bit is a pair of
+// planes, as in VPI's aval/bval: 0 = (0,0), 1 = (1,0), z = (0,1) and
+// x = (1,1). Literals up to 64 bits wide keep both planes inline; wider
+// ones keep ceil(width/64) aval words followed by as many bval words in
+// LiteralTable.words, least significant word first.
+
+#define LIT_SIGNED  0x1
+#define LIT_SIZED   0x2     // has a width prefix
+#define LIT_BASED   0x4     // has a base, i.e. is not a plain number
+#define LIT_XZ      0x8     // some bval bit is set
+
+typedef struct {
+    uint32_t width;
+    uint8_t base;           // 2, 8, 10 or 16, as written
+    uint8_t flags;
+    union {
+        struct {
+            uint64_t aval;
+            uint64_t bval;
+        };
+        size_t word_offset; // width > 64: start in LiteralTable.words
+    };
+} Literal;
+
+typedef struct {
+    Literal * lits;         // stb_ds array, indexed by TokenList.values
+    uint64_t * words;       // stb_ds array
+} LiteralTable;
+
+uint32_t decode_literal(LiteralTable * lt, const char * s, size_t len);
+const Literal * literal_at(const LiteralTable * lt, uint32_t index);
+const uint64_t * literal_aval(const LiteralTable * lt, const Literal * lit);
+const uint64_t * literal_bval(const LiteralTable * lt, const Literal * lit);
+int64_t literal_int64(const LiteralTable * lt, uint32_t index);
+size_t format_literal(const LiteralTable * lt, uint32_t index, char * out, size_t cap);
+uint32_t append_literals(LiteralTable * dst, const LiteralTable * src);
+void clear_literals(LiteralTable * lt);
+void free_literals(LiteralTable * lt);
+
+#endif /* LITERAL_H */
@@ -1,1033 +1,360 @@
 #define STB_DS_IMPLEMENTATION
+#include "alloc.h"
 #include "stb_ds.h"
 #include "common.h"
+#include "symtab.h"
+#include "literal.h"
+#include "arena.h"
+#include "ast.h"
 #include "tokenizer.h"
+#include "parser.h"
+#include "pool.h"
+#include "cache.h"
+#include "design.h"
+#include "emit.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
 
-// TODO: consider tokenizing entire file up front
-// TODO: use arena allocator
 // TODO: helpful error messages
-// TODO: TOK_XNOR: "^~" and "~^"?
 
-typedef enum {
-    AST_ROOT,
-    AST_MODULE_DEF,
-    AST_MODULE_BODY,
-    AST_PORT_LIST,
-    AST_BITRANGE,
-    AST_NUMBER,
-    AST_INPUT,
-    AST_OUTPUT,
-    AST_PARAM_LIST,
-    AST_INSTANTIATION,
-    AST_PORT_MAP_LIST,
-    AST_PORT_MAP,
-    AST_CONT_ASSIGN,
-    AST_ALWAYS,
-    AST_SENSITIVITY_LIST,
-    AST_INITIAL,
-    AST_IF,
-    AST_NON_BLOCKING,
-    AST_BLOCKING,
-    AST_DPI,
-    AST_WIRE_DECL,
-    AST_REG_DECL,
-    AST_IDENT,
-    AST_BITWISE_OR,
-    AST_BITWISE_AND,
-    AST_BITWISE_XOR,
-    AST_BITWISE_INVERT,
-    AST_LOGICAL_AND,
-    AST_LOGICAL_OR,
-    AST_EQ,
-    AST_NEQ,
-    AST_PAREN,
-    AST_INDEX,
-    AST_CONCAT,
-    AST_LITERAL,
-    AST_DELAY,
-    AST_BLOCK,
-} AstNodeType;
+// In --stream mode the input is lexed, parsed and printed one module at a
+// time, so memory is bounded by the window plus the largest module.
+#ifndef STREAM_WINDOW_SIZE
+#define STREAM_WINDOW_SIZE (1 << 20)
+#endif
 
-typedef struct AstNode {
-    AstNodeType type;
-    size_t len;
-    union {
-        char * label;
-        int64_t number;
-    };
-    struct AstNode ** children;
-} AstNode;
+#ifndef EMIT_BUFFER_SIZE
+#define EMIT_BUFFER_SIZE (1 << 20)
+#endif
 
+// One line per module: its name, then the modules it instantiates. Lazy
+// bodies are expanded even though their AST_IDENT kids already name
+// these, so that a module whose body has a syntax error is left out and
+// reported, as it would be without --lazy.
 static void
-print_ast_depth(const AstNode * ast, FILE * fp, int depth)
-{
-    //for (int i = 0; i < depth; i++)
-    //    fprintf(fp, "  ");
-    switch (ast->type) {
-        case AST_ROOT: {
-                for (size_t i = 0; i < arrlenu(ast->children); i++) {
-                    print_ast_depth(ast->children[i], fp, depth + 1);
-                }
-            }
-            break;
-        case AST_MODULE_DEF: {
-                fprintf(fp, "module %.*s (\n", (int) ast->len, ast->label);
-                print_ast_depth(ast->children[1], fp, depth + 1);
-                fprintf(fp, ")\n");
-                print_ast_depth(ast->children[2], fp, depth + 1);
-                fprintf(fp, "endmodule\n\n");
-            }
-            break;
-        case AST_MODULE_BODY: {
-                for (size_t i = 0; i < arrlenu(ast->children); i++) {
-                    print_ast_depth(ast->children[i], fp, depth + 1);
-                }
-            }
-            break;
-        case AST_PORT_LIST: {
-                for (size_t i = 0; i < arrlenu(ast->children); i++) {
-                    print_ast_depth(ast->children[i], fp, depth + 1);
-                }
-            }
-            break;
-        case AST_BITRANGE: {
-                fprintf(fp, "[%ld:%ld]", ast->children[0]->number, ast->children[1]->number);
-            }
-            break;
-        case AST_NUMBER:
-            fprintf(fp, "%ld", ast->number);
-            break;
-        case AST_INPUT: {
-                fprintf(fp, "input ");
-                for (size_t i = 0; i < arrlenu(ast->children); i++) {
-                    print_ast_depth(ast->children[i], fp, depth + 1);
-                }
-                fprintf(fp, " %.*s,\n", (int) ast->len, ast->label);
-            }
-            break;
-        case AST_OUTPUT: {
-                fprintf(fp, "output ");
-                for (size_t i = 0; i < arrlenu(ast->children); i++) {
-                    print_ast_depth(ast->children[i], fp, depth + 1);
-                }
-                fprintf(fp, " %.*s,\n", (int) ast->len, ast->label);
-            }
-            break;
-        case AST_PARAM_LIST:
-            break;
-        case AST_INSTANTIATION:
-            fprintf(fp, "%.*s %.*s(\n", (int) ast->children[0]->len, ast->children[0]->label, (int) ast->children[0]->len, ast->children[1]->label);
-            print_ast_depth(ast->children[2], fp, depth + 1);
-            fprintf(fp, "\n);\n");
-            break;
-        case AST_PORT_MAP_LIST: {
-                for (size_t i = 0; i < arrlenu(ast->children); i++) {
-                    if (i > 0)
-                        fprintf(fp, ",\n");
-                    print_ast_depth(ast->children[i], fp, depth + 1);
-                }
-            }
-            break;
-        case AST_PORT_MAP:
-            fprintf(fp, ".");
-            fprintf(fp, "%.*s", (int) ast->children[0]->len, ast->children[0]->label);
-            fprintf(fp, "(");
-            print_ast_depth(ast->children[1], fp, depth + 1);
-            fprintf(fp, ")");
-            break;
-        case AST_CONT_ASSIGN:
-            fprintf(fp, "assign ");
-            print_ast_depth(ast->children[0], fp, depth + 1);
-            fprintf(fp, " = ");
-            print_ast_depth(ast->children[1], fp, depth + 1);
-            fprintf(fp, ";\n");
-            break;
-        case AST_ALWAYS:
-            fprintf(fp, "always ");
-            print_ast_depth(ast->children[0], fp, depth + 1);
-            fprintf(fp, " ");
-            print_ast_depth(ast->children[1], fp, depth + 1);
-            break;
-        case AST_SENSITIVITY_LIST: {
-                fprintf(fp, "@(");
-                for (size_t i = 0; i < arrlenu(ast->children); i++) {
-                    if (i > 0)
-                        fprintf(fp, ",\n");
-                    print_ast_depth(ast->children[i], fp, depth + 1);
-                }
-                fprintf(fp, ")");
+emit_hierarchy(Emitter * e, Ast * ast, const SymbolTable * symtab, Diagnostic ** errors)
+{
+    for (uint32_t i = 0; i < ast_nkids(ast, ast->root); i++) {
+        NodeId module_def = ast_kid(ast, ast->root, i);
+        Diagnostic error;
+        NodeId body = expand_module_body(ast, module_def, &error);
+        if (!body) {
+            arrput(*errors, error);
+            continue;
+        }
+        emit_str(e, sym_str(symtab, ast_value(ast, module_def)));
+        emit_char(e, ':');
+        for (uint32_t k = 0; k < ast_nkids(ast, body); k++) {
+            NodeId kid = ast_kid(ast, body, k);
+            if (ast_type(ast, kid) != AST_INSTANTIATION)
+                continue;
+            emit_char(e, ' ');
+            emit_str(e, sym_str(symtab, ast_value(ast, ast_kid(ast, kid, 0))));
+        }
+        if (ast_type(ast, body) == AST_NETLIST_BODY) {
+            const Netlist * nl = &ast->netlist;
+            NetlistBody nb = nl->bodies[ast_value(ast, body)];
+            for (uint32_t c = nb.cell_begin; c < nb.cell_end; c++) {
+                emit_char(e, ' ');
+                emit_str(e, sym_str(symtab, nl->cells[c].type));
             }
-            break;
-        case AST_INITIAL: {
-                fprintf(fp, "initial\n");
-                for (size_t i = 0; i < arrlenu(ast->children); i++) {
-                    print_ast_depth(ast->children[i], fp, depth + 1);
-                }
-            }
-            break;
-        case AST_IF: {
-                fprintf(fp, "if (");
-                print_ast_depth(ast->children[0], fp, depth + 1);
-                fprintf(fp,  ")\n");
-                print_ast_depth(ast->children[1], fp, depth + 1);
-                if (ast->children[2]) {
-                    fprintf(fp, "else\n");
-                    print_ast_depth(ast->children[2], fp, depth + 1);
-                }
-            }
-            break;
-        case AST_NON_BLOCKING:
-            print_ast_depth(ast->children[0], fp, depth + 1);
-            fprintf(fp, " <= ");
-            print_ast_depth(ast->children[1], fp, depth + 1);
-            fprintf(fp, ";\n");
-            break;
-        case AST_BLOCKING:
-            print_ast_depth(ast->children[0], fp, depth + 1);
-            fprintf(fp, " = ");
-            print_ast_depth(ast->children[1], fp, depth + 1);
-            fprintf(fp, ";\n");
-            break;
-        case AST_DPI:
-            fprintf(fp, "$%.*s();\n", (int) ast->len, ast->label);
-            break;
-        case AST_WIRE_DECL:
-        case AST_REG_DECL: {
-                if (ast->type == AST_WIRE_DECL)
-                    fprintf(fp, "wire");
-                else
-                    fprintf(fp, "reg");
-                if (ast->children[0]) {
-                    fprintf(fp, " ");
-                    print_ast_depth(ast->children[0], fp, depth + 1);
-                }
-                fprintf(fp, " %.*s ", (int) ast->len, ast->label);
-                for (size_t i = 1; i < arrlenu(ast->children); i++) {
-                    print_ast_depth(ast->children[i], fp, depth + 1);
-                }
-                fprintf(fp, ";\n");
-            }
-            break;
-        case AST_IDENT:
-            fprintf(fp, "%.*s", (int) ast->len, ast->label);
-            break;
-        case AST_BITWISE_OR:
-            print_ast_depth(ast->children[0], fp, depth + 1);
-            fprintf(fp, " | ");
-            print_ast_depth(ast->children[1], fp, depth + 1);
-            break;
-        case AST_BITWISE_AND:
-            print_ast_depth(ast->children[0], fp, depth + 1);
-            fprintf(fp, " & ");
-            print_ast_depth(ast->children[1], fp, depth + 1);
-            break;
-        case AST_BITWISE_XOR:
-            print_ast_depth(ast->children[0], fp, depth + 1);
-            fprintf(fp, " ^ ");
-            print_ast_depth(ast->children[1], fp, depth + 1);
-            break;
-        case AST_BITWISE_INVERT:
-            fprintf(fp, "~");
-            print_ast_depth(ast->children[0], fp, depth + 1);
-            break;
-        case AST_LOGICAL_AND:
-            print_ast_depth(ast->children[0], fp, depth + 1);
-            fprintf(fp, " && ");
-            print_ast_depth(ast->children[1], fp, depth + 1);
-            break;
-        case AST_LOGICAL_OR:
-            print_ast_depth(ast->children[0], fp, depth + 1);
-            fprintf(fp, " || ");
-            print_ast_depth(ast->children[1], fp, depth + 1);
-            break;
-        case AST_EQ:
-            print_ast_depth(ast->children[0], fp, depth + 1);
-            fprintf(fp, " == ");
-            print_ast_depth(ast->children[1], fp, depth + 1);
-            break;
-        case AST_NEQ:
-            print_ast_depth(ast->children[0], fp, depth + 1);
-            fprintf(fp, " != ");
-            print_ast_depth(ast->children[1], fp, depth + 1);
-            break;
-        case AST_PAREN:
-            fprintf(fp, "(");
-            print_ast_depth(ast->children[0], fp, depth + 1);
-            fprintf(fp, ")");
-            break;
-        case AST_INDEX:
-            print_ast_depth(ast->children[0], fp, depth + 1);
-            fprintf(fp, "[");
-            print_ast_depth(ast->children[1], fp, depth + 1);
-            fprintf(fp, "]");
-            break;
-        case AST_CONCAT:
-            break;
-        case AST_LITERAL:
-            break;
-        case AST_DELAY:
-            break;
-        case AST_BLOCK: {
-                fprintf(fp, "begin\n");
-                for (size_t i = 0; i < arrlenu(ast->children); i++) {
-                    print_ast_depth(ast->children[i], fp, depth + 1);
-                }
-                fprintf(fp, "end\n");
-            }
-            break;
-        default: assert(0);
+        }
+        emit_newline(e);
     }
 }
 
-static void
-print_ast(const AstNode * ast, FILE * fp)
-{
-    print_ast_depth(ast, fp, 0);
-}
-
-static void
-ast_destroy(AstNode * ast)
-{
-    if (!ast)
-        return;
-    for (size_t i = 0; i < arrlenu(ast->children); i++)
-        ast_destroy(ast->children[i]);
-    arrfree(ast->children);
-    free(ast);
-}
-
-static Tokenizer tz;
-
-#if 0
-static AstNode *
-parse_dummy()
-{
-    Tokenizer saved_tz = tz;
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-#endif
+typedef enum {
+    FORMAT_VERILOG,
+    FORMAT_HIERARCHY,
+    FORMAT_JSON,
+    FORMAT_BIN,             // the AST cache's image, see cache.h
+} Format;
 
-// TODO: use this
 typedef struct {
-    int64_t value;
-    int width;
-    int is_signed;
-} Literal;
-
-static int64_t
-parse_literal(char * s)
-{
-    long size = 32;
-    char * endptr = s;
-    if (*s != '\'')
-        size = strtol(s, &endptr, 10);
-    assert(*endptr == '\'');
-    endptr++;
-    int base = 0;
-    if      (*endptr == 'b') base = 2;
-    else if (*endptr == 'o') base = 8;
-    else if (*endptr == 'd') base = 10;
-    else if (*endptr == 'h') base = 16;
-    else assert(0);
-    endptr++;
-    long number = strtol(endptr, NULL, base);
-    return number;
-}
+    size_t ast_peak;        // largest tree printed
+    size_t cells;           // netlist totals over everything printed
+    size_t pins;
+    size_t nets;
+    size_t netlist_bytes;
+    PhaseTimes times;       // printing and freeing; parsing keeps its own
+} Totals;
 
-static AstNode *
-parse_bitrange()
-{
-    Tokenizer saved_tz = tz;
-
-    Token tok1, tok2;
-    if (get_token(&tz).type != '[') goto no_match;
-    tok1 = get_token(&tz);
-    if (tok1.type != TOK_NUMBER)    goto no_match;
-    if (get_token(&tz).type != ':') goto no_match;
-    tok2 = get_token(&tz);
-    if (tok2.type != TOK_NUMBER)    goto no_match;
-    if (get_token(&tz).type != ']') goto no_match;
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_BITRANGE, .label = "" };
-    AstNode * lchild = malloc(sizeof(*lchild));
-    *lchild = (AstNode) { .type = AST_NUMBER, .number = strtol(tok1.str, NULL, 0) };
-    AstNode * rchild = malloc(sizeof(*rchild));
-    *rchild = (AstNode) { .type = AST_NUMBER, .number = strtol(tok2.str, NULL, 0) };
-    arrput(node->children, lchild);
-    arrput(node->children, rchild);
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_port_decl(int leading_comma)
-{
-    Tokenizer saved_tz = tz;
-
-    // TODO: handle K&R style
 
-    if (leading_comma && get_token(&tz).type != ',')
-        goto no_match;
-
-    AstNodeType port_type;
-    Token tok = get_token(&tz);
-    if      (tok.type == TOK_INPUT)     port_type = AST_INPUT;
-    else if (tok.type == TOK_OUTPUT)    port_type = AST_OUTPUT;
-    else                                goto no_match;
-
-    AstNode * bitrange = parse_bitrange();
-    tok = get_token(&tz);
-    if (tok.type != TOK_IDENT) goto no_match;
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = port_type, .label = tok.str, .len = tok.len };
-    if (bitrange) {
-        arrput(node->children, bitrange);
-    }
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_port_list()
-{
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_PORT_LIST, .label = "" };
-    int leading_comma = 0;
-    while (1) {
-        AstNode * port_decl = parse_port_decl(leading_comma);
-        if (!port_decl)
+// Prints the result of the last parse and adds it to the totals. Lazy
+// bodies that turn out not to parse are appended to errors.
+static void
+emit_result(Emitter * e, Ast * ast, const SymbolTable * symtab, Format format, Totals * totals,
+            Diagnostic ** errors)
+{
+    Stopwatch sw = start_stopwatch();
+    switch (format) {
+        case FORMAT_VERILOG:
+            emit_verilog(e, ast, symtab, errors);
+            break;
+        case FORMAT_HIERARCHY:
+            emit_hierarchy(e, ast, symtab, errors);
+            break;
+        case FORMAT_JSON:
+            emit_json(e, ast, symtab, errors);
+            break;
+        case FORMAT_BIN: {
+                // readers get trees, not the tokens of lazy bodies, so a
+                // module whose body does not parse is dropped from the root
+                size_t mark = ast_mark(ast);
+                for (uint32_t i = 0; i < ast_nkids(ast, ast->root); i++) {
+                    NodeId module_def = ast_kid(ast, ast->root, i);
+                    Diagnostic error;
+                    if (expand_module_body(ast, module_def, &error))
+                        ast_push(ast, module_def);
+                    else
+                        arrput(*errors, error);
+                }
+                ast->root = ast_finish(ast, AST_ROOT, 0, mark);
+                char * image = serialize_ast(0, ast, symtab);
+                emit_bytes(e, image, arrlenu(image));
+                arrfree(image);
+            }
             break;
-        arrput(node->children, port_decl);
-        leading_comma = 1;
     }
-    return node;
-}
-
-static AstNode *
-parse_index()
-{
-    Tokenizer saved_tz = tz;
-
-    Token tok1, tok2;
-    tok1 = get_token(&tz);
-    if (tok1.type != TOK_IDENT)     goto no_match;
-    if (get_token(&tz).type != '[') goto no_match;
-    tok2 = get_token(&tz);
-    if (tok2.type != TOK_NUMBER)    goto no_match;
-    if (get_token(&tz).type != ']') goto no_match;
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_INDEX, .label = "" };
-    AstNode * ident = malloc(sizeof(*node));
-    *ident = (AstNode) { .type = AST_IDENT, .label = tok1.str, .len = tok1.len };
-    AstNode * index = malloc(sizeof(*node));
-    *index = (AstNode) { .type = AST_NUMBER, .number = strtol(tok2.str, NULL, 0) };
-    arrput(node->children, ident);
-    arrput(node->children, index);
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_lvalue()
-{
-    Tokenizer saved_tz = tz;
-
-    AstNode * index = parse_index();
-    if (index) return index;
-    Token tok = get_token(&tz);
-    if (tok.type != TOK_IDENT) goto no_match;
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_IDENT, .label = tok.str, .len = tok.len };
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode * parse_expr();
-
-static AstNode *
-parse_parentheses()
-{
-    Tokenizer saved_tz = tz;
-
-    Token tok = get_token(&tz);
-    if (tok.type != '(')    goto no_match;
-    AstNode * expr = parse_expr();
-    tok = get_token(&tz);
-    if (tok.type != ')')    goto no_match;
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_PAREN, .label = "" };
-    arrput(node->children, expr);
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_unary_op()
-{
-    // TODO:
-    //  parse_and_reduce()
-    //  parse_nand_reduce()
-    //  parse_or_reduce()
-    //  parse_nor_reduce()
-    //  parse_xor_reduce()
-    //  parse_xnor_reduce()
-    //  parse_bitwise_not()
-}
-
-static AstNode *
-parse_rvalue()
-{
-    Tokenizer saved_tz = tz;
-
-    AstNode * lvalue = parse_lvalue();
-    if (lvalue) return lvalue;
-    AstNode * paren = parse_parentheses();
-    if (paren) return paren;
-    // TODO: parse_unary()
-    Token tok = get_token(&tz);
-    if (tok.type != TOK_LITERAL) goto no_match;
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_NUMBER, .number = parse_literal(tok.str) };
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
+    stop_stopwatch(sw, &totals->times, PHASE_PRINT);
+    if (ast_bytes(ast) > totals->ast_peak)
+        totals->ast_peak = ast_bytes(ast);
+    totals->cells += arrlenu(ast->netlist.cells);
+    totals->pins += arrlenu(ast->netlist.pin_names);
+    totals->nets += arrlenu(ast->netlist.nets);
+    totals->netlist_bytes += netlist_bytes(&ast->netlist);
 }
 
-static AstNode *
-parse_binary_op()
+static size_t
+report_diagnostics(const Diagnostic * diags, size_t n, const char * path)
 {
-    Tokenizer saved_tz = tz;
-
-    AstNode * lhs = parse_rvalue();
-    if (!lhs)                       goto no_match;
-    Token tok = get_token(&tz);
-    AstNodeType op_type;
-    if      (tok.type == '|')               op_type = AST_BITWISE_OR;
-    else if (tok.type == '&')               op_type = AST_BITWISE_AND;
-    else if (tok.type == '^')               op_type = AST_BITWISE_XOR;
-    else if (tok.type == TOK_LOGICAL_AND)   op_type = AST_LOGICAL_AND;
-    else if (tok.type == TOK_LOGICAL_OR)    op_type = AST_LOGICAL_OR;
-    else if (tok.type == TOK_EQ)            op_type = AST_EQ;
-    else if (tok.type == TOK_NEQ)           op_type = AST_NEQ;
-    else                                    goto no_match;
-    AstNode * rhs = parse_expr();
-    if (!rhs)                       goto no_match;
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = op_type, .label = "" };
-    arrput(node->children, lhs);
-    arrput(node->children, rhs);
-    return node;
-
-no_match:
-    if (lhs) ast_destroy(lhs);
-    tz = saved_tz;
-    return NULL;
+    for (size_t i = 0; i < n; i++)
+        fprintf(stderr, "%s: error at byte %zu: %s\n", path ? path : diags[i].path,
+                diags[i].offset, diags[i].message);
+    return n;
 }
 
-// TODO: operator precedence
-static AstNode *
-parse_expr()
-{
-    AstNode * node;
-
-    // TODO: parse_ternary()
-    if      (node = parse_binary_op())  return node;
-    else if (node = parse_rvalue())     return node;
-
-    return NULL;
-}
-
-static AstNode * parse_procedural_stmt();
-
-static AstNode *
-parse_blocking_non_blocking()
+static size_t
+stream_verilog(ParseCtx * ctx, Emitter * e, const char * filename, Format format, Totals * totals)
 {
-    Tokenizer saved_tz = tz;
-
-    // TODO: inter- and intra-assignment delays
-    AstNode * dst = parse_lvalue();
-    if (!dst)                       goto no_match;
-    Token tok = get_token(&tz);
-    AstNodeType node_type;
-    if      (tok.type == TOK_LTE)   node_type = AST_NON_BLOCKING;
-    else if (tok.type == '=')       node_type = AST_BLOCKING;
-    else                            goto no_match;
-    AstNode * expr = parse_expr();
-    if (!expr)                      goto no_match;
-    if (get_token(&tz).type != ';') goto no_match;
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = node_type, .label = "" };
-    arrput(node->children, dst);
-    arrput(node->children, expr);
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_else()
-{
-    Tokenizer saved_tz = tz;
-
-    if (get_token(&tz).type != TOK_ELSE) goto no_match;
-    AstNode * stmt = parse_procedural_stmt();
-    if (!stmt) goto no_match;
-    return stmt;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_if_stmt()
-{
-    Tokenizer saved_tz = tz;
-
-    if (get_token(&tz).type != TOK_IF)  goto no_match;
-    if (get_token(&tz).type != '(')     goto no_match;
-    AstNode * cond = parse_expr();
-    if (!cond)                          goto no_match;
-    if (get_token(&tz).type != ')')     goto no_match;
-    AstNode * stmt = parse_procedural_stmt();
-    if (!stmt)                          goto no_match;
-    AstNode * else_node = parse_else();
-
-    // TODO: should else-if be handled specifically?
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_IF, .label = "" };
-    arrput(node->children, cond);
-    arrput(node->children, stmt);
-    arrput(node->children, else_node);
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_delay()
-{
-    Tokenizer saved_tz = tz;
-
-    if (get_token(&tz).type != '#') goto no_match;
-    Token tok = get_token(&tz);
-    if (tok.type != TOK_NUMBER)     goto no_match;
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_DELAY, .number = strtol(tok.str, NULL, 0) };
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_dpi()
-{
-    Tokenizer saved_tz = tz;
-
-    if (get_token(&tz).type != '$') goto no_match;
-    Token tok = get_token(&tz);
-    if (tok.type != TOK_IDENT)      goto no_match;
-    if (get_token(&tz).type != '(') goto no_match;
-    // TODO: arguments
-    if (get_token(&tz).type != ')') goto no_match;
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_DPI, .label = tok.str, .len = tok.len };
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_block()
-{
-    Tokenizer saved_tz = tz;
-
-    if (get_token(&tz).type != TOK_BEGIN)   goto no_match;
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_BLOCK, .label = "" };
-    while (1) {
-        AstNode * stmt = parse_procedural_stmt();
-        if (!stmt)
-            break;
-        arrput(node->children, stmt);
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        perror(filename);
+        exit(EXIT_FAILURE);
     }
-    if (get_token(&tz).type != TOK_END)     goto no_match;
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_empty_stmt()
-{
-    Tokenizer saved_tz = tz;
-    if (get_token(&tz).type != ';') goto no_match;
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_procedural_stmt()
-{
-    Tokenizer saved_tz = tz;
-
-    AstNode * stmt;
-    if      (stmt = parse_block())                  ;
-    else if (stmt = parse_if_stmt())                ;
-    else if (stmt = parse_blocking_non_blocking())  ;
-    else if (stmt = parse_delay())                  ;
-    else if (stmt = parse_dpi())                    ;
-    else if (stmt = parse_empty_stmt())             ;
-    else                                            goto no_match;
-
-    return stmt;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_sensitivity_list()
-{
-    Tokenizer saved_tz = tz;
-
-    // TODO: this is hard-coded
-    if (get_token(&tz).type != TOK_POSEDGE) goto no_match;
-    if (get_token(&tz).type != TOK_IDENT)   goto no_match;
-    if (get_token(&tz).type != TOK_OR)      goto no_match;
-    if (get_token(&tz).type != TOK_POSEDGE) goto no_match;
-    if (get_token(&tz).type != TOK_IDENT)   goto no_match;
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_SENSITIVITY_LIST, .label = "" };
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_always()
-{
-    Tokenizer saved_tz = tz;
-
-    if (get_token(&tz).type != TOK_ALWAYS)  goto no_match;
-    if (get_token(&tz).type != '@')         goto no_match;
-    if (get_token(&tz).type != '(')         goto no_match;
-    AstNode * sensitivity_list = parse_sensitivity_list();
-    if (!sensitivity_list)                  goto no_match;
-    if (get_token(&tz).type != ')')         goto no_match;
-    AstNode * stmt = parse_block();
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_ALWAYS, .label = "" };
-    arrput(node->children, sensitivity_list);
-    arrput(node->children, stmt);
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_initial()
-{
-    Tokenizer saved_tz = tz;
-
-    if (get_token(&tz).type != TOK_INITIAL) goto no_match;
-    AstNode * stmt = parse_block();
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_INITIAL, .label = "" };
-    arrput(node->children, stmt);
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_port_map(int leading_comma)
-{
-    Tokenizer saved_tz = tz;
-
-    if (leading_comma && get_token(&tz).type != ',')    goto no_match;
-
-    Token tok1, tok2;
-    if (get_token(&tz).type != '.') goto no_match;
-    tok1 = get_token(&tz);
-    if (tok1.type != TOK_IDENT)     goto no_match;
-    if (get_token(&tz).type != '(') goto no_match;
-    AstNode * rchild = parse_expr();
-    if (!rchild)                    goto no_match;
-    if (get_token(&tz).type != ')') goto no_match;
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_PORT_MAP, .label = "" };
-    AstNode * lchild = malloc(sizeof(*node));
-    *lchild = (AstNode) { .type = AST_IDENT, .label = tok1.str, .len = tok1.len };
-    arrput(node->children, lchild);
-    arrput(node->children, rchild);
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_port_map_list()
-{
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_PORT_MAP_LIST, .label = "" };
-
-    int leading_comma = 0;
+    StreamTokenizer st = open_stream_tokenizer(fd, STREAM_WINDOW_SIZE);
+    TokenList module_toks = {0};
+    size_t errors = 0;
     while (1) {
-        AstNode * port_map = parse_port_map(leading_comma);
-        if (!port_map)
-            break;
-        arrput(node->children, port_map);
-        leading_comma = 1;
+        // reading is part of lexing here: the window is refilled as needed
+        Stopwatch sw = start_stopwatch();
+        bool more = stream_tokenize_module(&st, &module_toks, &ctx->symtab);
+        stop_stopwatch(sw, &ctx->stats.times, PHASE_LEX);
+        if (!more)
+            break;
+        parse_tokens(ctx, &module_toks);
+        emit_result(e, &ctx->ast, &ctx->symtab, format, totals, &ctx->diags);
+        errors += report_diagnostics(ctx->diags, arrlenu(ctx->diags), filename);
+        clear_symtab(&ctx->symtab); // keep memory bounded by the module
     }
-
-    return node;
-}
-
-static AstNode *
-parse_instantiation()
-{
-    Tokenizer saved_tz = tz;
-
-    Token tok1, tok2;
-    tok1 = get_token(&tz); // module name
-    if (tok1.type != TOK_IDENT)     goto no_match;
-    tok2 = get_token(&tz); // instance name
-    if (tok2.type != TOK_IDENT)     goto no_match;
-    if (get_token(&tz).type != '(') goto no_match;
-    AstNode * port_map_list = parse_port_map_list();
-    if (get_token(&tz).type != ')') goto no_match;
-    if (get_token(&tz).type != ';') goto no_match;
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_INSTANTIATION, .label = "" };
-    AstNode * module_name = malloc(sizeof(*module_name));
-    *module_name = (AstNode) { .type = AST_IDENT, .label = tok1.str, .len = tok1.len };
-    AstNode * instance_name = malloc(sizeof(*instance_name));
-    *instance_name = (AstNode) { .type = AST_IDENT, .label = tok2.str, .len = tok2.len };
-    arrput(node->children, module_name);
-    arrput(node->children, instance_name);
-    arrput(node->children, port_map_list);
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_signal_decl()
-{
-    Tokenizer saved_tz = tz;
-
-    AstNode * node = NULL;
-
-    Token tok = get_token(&tz);
-    AstNodeType signal_type;
-    if      (tok.type == TOK_WIRE)  signal_type = AST_WIRE_DECL;
-    else if (tok.type == TOK_REG)   signal_type = AST_REG_DECL;
-    else                            goto no_match;
-
-    AstNode * bitrange = parse_bitrange();
-    tok = get_token(&tz);
-    // TODO: multiple declaration: wire a, b, c;
-    if (tok.type != TOK_IDENT)      goto no_match;
-
-    node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = signal_type, .label = tok.str, .len = tok.len };
-    arrput(node->children, bitrange);
-    AstNode * array;
-    while (array = parse_bitrange()) {
-        arrput(node->children, array);
-    }
-    if (get_token(&tz).type != ';') goto no_match;
-
-    return node;
-
-no_match:
-    if (node) ast_destroy(node);
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_param_decl()
-{
-    Tokenizer saved_tz = tz;
-    // TODO
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_assign()
-{
-    Tokenizer saved_tz = tz;
-
-    if (get_token(&tz).type != TOK_ASSIGN)  goto no_match;
-    Token tok = get_token(&tz);
-    if (tok.type != TOK_IDENT)              goto no_match;
-    if (get_token(&tz).type != '=')         goto no_match;
-    AstNode * expr = parse_expr();
-    if (!expr)                              goto no_match;
-    if (get_token(&tz).type != ';')         goto no_match;
-
-    AstNode * assign = malloc(sizeof(*assign));
-    *assign = (AstNode) { .type = AST_CONT_ASSIGN, .label = "" };
-    AstNode * dst = malloc(sizeof(*assign));
-    *dst = (AstNode) { .type = AST_IDENT, .label = tok.str, .len = tok.len };
-    arrput(assign->children, dst);
-    arrput(assign->children, expr);
-    return assign;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
+    free_tokens(&module_toks);
+    close_stream_tokenizer(&st);
+    close(fd);
+    return errors;
 }
 
-static AstNode *
-parse_module_body()
-{
-    AstNode * body = malloc(sizeof(*body));
-    *body = (AstNode) { .type = AST_MODULE_BODY, .label = "" };
-
-    while (1) {
-        AstNode * stmt;
-        if      (stmt = parse_signal_decl())    ;
-        else if (stmt = parse_param_decl())     ;
-        else if (stmt = parse_assign())         ;
-        else if (stmt = parse_instantiation())  ;
-        else if (stmt = parse_always())         ;
-        else if (stmt = parse_initial())        ;
-        else                                    break;
-        arrput(body->children, stmt);
+typedef enum {
+    STATS_OFF,
+    STATS_REPORT,
+    STATS_JSON,
+} StatsFormat;
+
+// --stats, on stderr like the other summaries. Backtracks are listed by
+// tokens given back, the biggest first, which is where a grammar path
+// that keeps failing late shows up.
+static void
+print_stats(StatsFormat stats, const ParseStats * ps, const Totals * totals, Stopwatch run)
+{
+    PhaseTimes times = ps->times;
+    add_phase_times(&times, &totals->times);
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    double total_wall = start_stopwatch().wall - run.wall;
+    double total_cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec*1e-6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec*1e-6;
+    AllocStats as = alloc_stats();
+
+    if (stats == STATS_JSON) {
+        fprintf(stderr, "{\"phases\":{");
+        for (int i = 0; i < NUM_PHASES; i++)
+            fprintf(stderr, "%s\"%s\":{\"wall\":%.6f,\"cpu\":%.6f}", i ? "," : "",
+                    phase_name(i), times.wall[i], times.cpu[i]);
+        fprintf(stderr, "},\"total\":{\"wall\":%.6f,\"cpu\":%.6f},", total_wall, total_cpu);
+        fprintf(stderr, "\"tokens\":%zu,\"nodes\":%zu,\"ast_bytes\":%zu,\"bytes_allocated\":%zu,"
+                "\"bytes_peak\":%zu,\"peak_rss_kb\":%ld,",
+                ps->tokens, ps->nodes, totals->ast_peak, as.allocated, as.peak, ru.ru_maxrss);
+        fprintf(stderr, "\"backtrack_min_tokens\":2,\"backtracks\":{");
+        for (int i = 0; i < NUM_BT_RULES; i++)
+            fprintf(stderr, "%s\"%s\":{\"count\":%zu,\"tokens\":%zu}", i ? "," : "",
+                    backtrack_rule_name(i), ps->backtracks[i], ps->rewound[i]);
+        fprintf(stderr, "}}\n");
+        return;
     }
 
-    return body;
-}
-
-static AstNode *
-parse_module_def()
-{
-    Tokenizer saved_tz = tz;
-
-    Token tok;
-    if (get_token(&tz).type != TOK_MODULE)          goto no_match;
-    if ((tok = get_token(&tz)).type != TOK_IDENT)   goto no_match;
-    if (get_token(&tz).type != '(')                 goto no_match;
-    AstNode * port_list = parse_port_list();
-    if (get_token(&tz).type != ')')                 goto no_match;
-    if (get_token(&tz).type != ';')                 goto no_match;
-    AstNode * body = parse_module_body();
-    if (!body)                                      goto no_match;
-    if (get_token(&tz).type != TOK_ENDMODULE)       goto no_match;
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_MODULE_DEF, .label = tok.str, .len = tok.len };
-    arrput(node->children, NULL);
-    arrput(node->children, port_list);
-    arrput(node->children, body);
-    return node;
-
-no_match:
-    tz = saved_tz;
-    return NULL;
-}
-
-static AstNode *
-parse_verilog(Buffer input)
-{
-    tz = init_tokenizer(input);
-
-    AstNode * node = malloc(sizeof(*node));
-    *node = (AstNode) { .type = AST_ROOT, .label = "" };
-    AstNode * module_def = parse_module_def();
-    if (module_def) {
-        arrput(node->children, module_def);
-    } else {
-        // TODO: error
+    fprintf(stderr, "stats: %-8s %10s %10s\n", "phase", "wall s", "cpu s");
+    for (int i = 0; i < NUM_PHASES; i++)
+        fprintf(stderr, "stats: %-8s %10.6f %10.6f\n", phase_name(i), times.wall[i], times.cpu[i]);
+    fprintf(stderr, "stats: %-8s %10.6f %10.6f\n", "total", total_wall, total_cpu);
+    fprintf(stderr, "stats: %zu tokens, %zu nodes, %zu bytes of tree\n", ps->tokens, ps->nodes, totals->ast_peak);
+    fprintf(stderr, "stats: %zu bytes allocated, %zu bytes at peak, %ld kB peak RSS\n",
+            as.allocated, as.peak, ru.ru_maxrss);
+    int order[NUM_BT_RULES];
+    int n = 0;
+    for (int i = 0; i < NUM_BT_RULES; i++) {
+        if (!ps->backtracks[i])
+            continue;
+        int k = n++;
+        for (; k > 0 && ps->rewound[order[k - 1]] < ps->rewound[i]; k--)
+            order[k] = order[k - 1];
+        order[k] = i;
     }
-    return node;
+    // a rule that gives back just the token it looked at is not counted
+    if (n)
+        fprintf(stderr, "stats: %-28s %12s %12s\n", "backtracks of 2+ tokens", "count", "tokens");
+    for (int k = 0; k < n; k++)
+        fprintf(stderr, "stats: %-28s %12zu %12zu\n", backtrack_rule_name(order[k]),
+                ps->backtracks[order[k]], ps->rewound[order[k]]);
 }
 
 int main(int argc, char * argv[])
 {
-    const char * filename = NULL;
+    Stopwatch run = start_stopwatch();
+    char ** filenames = NULL;
+    int use_memo = 0;
+    int stream = 0;
+    int arena_stats = 0;
+    int lazy = 0;
+    Format format = FORMAT_VERILOG;
+    int netlist = 0;
+    StatsFormat stats = STATS_OFF;
+    int nthreads = num_cores();
+    const char * cache_dir = NULL;
+    const char * output = NULL;
     for (int i = 1; i < argc; i++) {
-        // TODO: allow for multiple input files
-        if (filename == NULL)
-            filename = argv[i];
-        else
-            die("error: cannot specify multiple input files\n");
+        if (!strcmp(argv[i], "--memo")) {
+            use_memo = 1;
+        } else if (!strcmp(argv[i], "--stream")) {
+            stream = 1;
+        } else if (!strcmp(argv[i], "--arena-stats")) {
+            arena_stats = 1;
+        } else if (!strcmp(argv[i], "--lazy")) {
+            lazy = 1;
+        } else if (!strcmp(argv[i], "--hierarchy")) {
+            format = FORMAT_HIERARCHY;
+        } else if (!strcmp(argv[i], "--emit=verilog")) {
+            format = FORMAT_VERILOG;
+        } else if (!strcmp(argv[i], "--emit=json")) {
+            format = FORMAT_JSON;
+        } else if (!strcmp(argv[i], "--emit=bin")) {
+            format = FORMAT_BIN;
+        } else if (!strcmp(argv[i], "--netlist")) {
+            netlist = 1;
+        } else if (!strcmp(argv[i], "--stats")) {
+            stats = STATS_REPORT;
+        } else if (!strcmp(argv[i], "--stats=json")) {
+            stats = STATS_JSON;
+        } else if (!strcmp(argv[i], "--cache-dir") && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            output = argv[++i];
+        } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            read_filelist(argv[++i], &filenames);
+        } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            int err = parse_int(argv[++i], &nthreads);
+            if (err || nthreads < 1)
+                die("error: -j %s: %s\n", argv[i], err ? parse_int_strerror(err) : "must be at least 1");
+        } else {
+            arrput(filenames, strdup(argv[i]));
+        }
     }
 
-    if (filename == NULL) {
-        die("usage: %s FILE\n", argv[0]);
+    if (arrlenu(filenames) == 0) {
+        die("usage: %s [--memo] [--stream] [--lazy] [--netlist] [--hierarchy] [--emit=verilog|json|bin] [--arena-stats] [--stats[=json]] [--cache-dir DIR] [-o OUTPUT] [-j THREADS] [-f FILELIST]... FILE...\n", argv[0]);
     }
 
-    Buffer file_contents = read_file(filename);
-    // TODO: strip_comments(file_contents.p, file_contents.len);
-    AstNode * ast = parse_verilog(file_contents);
-    print_ast(ast, stdout);
-    ast_destroy(ast);
-
-    return 0;
+    // one image holds one tree, and netlists are not part of it
+    if (format == FORMAT_BIN && (stream || netlist))
+        die("error: --emit=bin cannot be combined with %s\n", stream ? "--stream" : "--netlist");
+
+    int out_fd = STDOUT_FILENO;
+    if (output) {
+        out_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd == -1) {
+            perror(output);
+            exit(EXIT_FAILURE);
+        }
+    }
+    Emitter emitter = init_emitter(out_fd, EMIT_BUFFER_SIZE);
+
+    size_t memo_hits = 0;
+    size_t arena_peak = 0;
+    Totals totals = {0};
+    ParseStats parse_stats = {0};
+    size_t errors = 0;
+    if (stream) {
+        ParseCtx ctx = init_parse_ctx(use_memo, lazy, netlist);
+        for (size_t i = 0; i < arrlenu(filenames); i++)
+            errors += stream_verilog(&ctx, &emitter, filenames[i], format, &totals);
+        memo_hits = ctx.memo_hits;
+        arena_peak = ctx.arena.peak;
+        parse_stats = ctx.stats;
+        Stopwatch sw = start_stopwatch();
+        free_parse_ctx(&ctx);
+        stop_stopwatch(sw, &totals.times, PHASE_FREE);
+    } else {
+        DesignOptions opts = {
+            .nthreads = nthreads,
+            .use_memo = use_memo,
+            .lazy = lazy,
+            .netlist = netlist,
+            .cache_dir = cache_dir,
+        };
+        Design design = parse_design(filenames, arrlenu(filenames), &opts);
+        emit_result(&emitter, &design.ast, &design.symtab, format, &totals, &design.diags);
+        errors = report_diagnostics(design.diags, arrlenu(design.diags), NULL);
+        memo_hits = design.memo_hits;
+        arena_peak = design.arena_peak;
+        parse_stats = design.stats;
+        if (cache_dir)
+            fprintf(stderr, "cache: %zu of %zu inputs cached\n", design.cache_hits, design.cache_lookups);
+        Stopwatch sw = start_stopwatch();
+        free_design(&design);
+        stop_stopwatch(sw, &totals.times, PHASE_FREE);
+    }
+    Stopwatch sw = start_stopwatch();
+    free_emitter(&emitter);     // the last of the output goes out here
+    stop_stopwatch(sw, &totals.times, PHASE_PRINT);
+    if (output && close(out_fd) == -1) {
+        perror(output);
+        exit(EXIT_FAILURE);
+    }
+    if (use_memo)
+        fprintf(stderr, "memo: %zu hits\n", memo_hits);
+    if (arena_stats)
+        fprintf(stderr, "arena: %zu bytes peak, ast: %zu bytes peak\n", arena_peak, totals.ast_peak);
+    if (netlist)
+        fprintf(stderr, "netlist: %zu cells, %zu pins, %zu nets, %zu bytes\n",
+                totals.cells, totals.pins, totals.nets, totals.netlist_bytes);
+    if (stats)
+        print_stats(stats, &parse_stats, &totals, run);
+    for (size_t i = 0; i < arrlenu(filenames); i++)
+        free(filenames[i]);
+    arrfree(filenames);
+
+    return errors ? EXIT_FAILURE : 0;
 }
@@ -0,0 +1,1521 @@
+#include "alloc.h"
+#include "stb_ds.h"
+#include "common.h"
+#include "symtab.h"
+#include "literal.h"
+#include "arena.h"
+#include "ast.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include <assert.h>
+#include <string.h>
+
+// Backtracking only has to save and restore ctx->tok_pos; the input is lexed
+// exactly once by tokenize(). The furthest token looked at is kept for
+// error reporting: when every alternative fails, that is where the input
+// stopped making sense.
+static Token
+next_token(ParseCtx * ctx)
+{
+    Token tok = token_at(&ctx->toks, ctx->tok_pos);
+    if (ctx->tok_pos > ctx->furthest)
+        ctx->furthest = ctx->tok_pos;
+    if (tok.type != TOK_EOF)
+        ctx->tok_pos++;
+    return tok;
+}
+
+// --stats counts the tokens each rule gives back when it fails. Giving
+// back the one token a rule looked at is lookahead rather than
+// backtracking, and is not counted.
+static void
+count_backtrack(ParseCtx * ctx, BacktrackRule rule, size_t ntokens)
+{
+    if (ntokens > 1) {
+        ctx->stats.backtracks[rule]++;
+        ctx->stats.rewound[rule] += ntokens;
+    }
+}
+
+static void
+backtrack(ParseCtx * ctx, BacktrackRule rule, size_t pos)
+{
+    count_backtrack(ctx, rule, ctx->tok_pos - pos);
+    ctx->tok_pos = pos;
+}
+
+// Optional packrat memoization. When enabled, the result of every memoized
+// rule is recorded per (rule, token position) so that a failed alternative
+// never causes the same tokens to be parsed by the same rule twice. A hit on
+// a successful entry hands back the very same node, which is fine because
+// nodes are never freed individually.
+
+typedef enum {
+    RULE_BITRANGE,
+    RULE_INDEX,
+    RULE_LVALUE,
+    RULE_PRIMARY,
+    RULE_EXPR,
+    RULE_BLOCKING_NON_BLOCKING,
+    RULE_IF_STMT,
+    RULE_BLOCK,
+    RULE_PROCEDURAL_STMT,
+    NUM_RULES
+} Rule;
+
+typedef enum {
+    MEMO_EMPTY=0,
+    MEMO_MATCH,
+    MEMO_NO_MATCH
+} MemoState;
+
+typedef struct MemoEntry {
+    NodeId node;
+    uint32_t end;
+    uint8_t state;
+} MemoEntry;
+
+static void
+memo_init(ParseCtx * ctx)
+{
+    size_t size = num_tokens(&ctx->toks)*NUM_RULES*sizeof(*ctx->memo);
+    ctx->memo = arena_alloc(&ctx->arena, size);
+    memset(ctx->memo, 0, size);
+}
+
+// Looks rule up at the current token. On a hit the result is in *node and
+// tok_pos is past the match.
+static bool
+memo_lookup(ParseCtx * ctx, Rule rule, NodeId * node)
+{
+    if (!ctx->memo)
+        return false;
+    MemoEntry * entry = &ctx->memo[ctx->tok_pos*NUM_RULES + rule];
+    if (entry->state == MEMO_EMPTY)
+        return false;
+    ctx->memo_hits++;
+    if (entry->state == MEMO_MATCH)
+        ctx->tok_pos = entry->end;
+    *node = entry->node;
+    return true;
+}
+
+static void
+memo_store(ParseCtx * ctx, Rule rule, size_t start, NodeId node)
+{
+    if (!ctx->memo)
+        return;
+    MemoEntry * entry = &ctx->memo[start*NUM_RULES + rule];
+    entry->node = node;
+    entry->end = ctx->tok_pos;
+    entry->state = node ? MEMO_MATCH : MEMO_NO_MATCH;
+}
+
+static NodeId
+memoize(ParseCtx * ctx, Rule rule, NodeId (*parse_fn)(ParseCtx *))
+{
+    NodeId node;
+    if (memo_lookup(ctx, rule, &node))
+        return node;
+    size_t start = ctx->tok_pos;
+    node = parse_fn(ctx);
+    memo_store(ctx, rule, start, node);
+    return node;
+}
+
+#define MEMOIZED(name, rule) \
+    static NodeId name##_uncached(ParseCtx * ctx); \
+    static NodeId name(ParseCtx * ctx) { return memoize(ctx, rule, name##_uncached); }
+
+MEMOIZED(parse_bitrange,                RULE_BITRANGE)
+MEMOIZED(parse_index,                   RULE_INDEX)
+MEMOIZED(parse_lvalue,                  RULE_LVALUE)
+MEMOIZED(parse_blocking_non_blocking,   RULE_BLOCKING_NON_BLOCKING)
+MEMOIZED(parse_if_stmt,                 RULE_IF_STMT)
+MEMOIZED(parse_block,                   RULE_BLOCK)
+MEMOIZED(parse_procedural_stmt,         RULE_PROCEDURAL_STMT)
+
+#if 0
+static NodeId
+parse_dummy(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+no_match:
+    ctx->tok_pos = saved_pos;
+    return AST_NULL;
+}
+#endif
+
+static NodeId
+parse_bitrange_uncached(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    Token tok1, tok2;
+    if (next_token(ctx).type != '[')   goto no_match;
+    tok1 = next_token(ctx);
+    if (tok1.type != TOK_NUMBER)    goto no_match;
+    if (next_token(ctx).type != ':')   goto no_match;
+    tok2 = next_token(ctx);
+    if (tok2.type != TOK_NUMBER)    goto no_match;
+    if (next_token(ctx).type != ']')   goto no_match;
+
+    NodeId lchild = ast_leaf(&ctx->ast, AST_NUMBER, tok1.value);
+    NodeId rchild = ast_leaf(&ctx->ast, AST_NUMBER, tok2.value);
+    return ast_new(&ctx->ast, AST_BITRANGE, 0, 2, (NodeId[]) { lchild, rchild });
+
+no_match:
+    backtrack(ctx, BT_BITRANGE, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_port_decl(ParseCtx * ctx, int leading_comma)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    // TODO: handle K&R style
+
+    if (leading_comma && next_token(ctx).type != ',')
+        goto no_match;
+
+    AstNodeType port_type;
+    Token tok = next_token(ctx);
+    if      (tok.type == TOK_INPUT)     port_type = AST_INPUT;
+    else if (tok.type == TOK_OUTPUT)    port_type = AST_OUTPUT;
+    else                                goto no_match;
+
+    NodeId bitrange = parse_bitrange(ctx);
+    tok = next_token(ctx);
+    if (tok.type != TOK_IDENT) goto no_match;
+
+    return ast_new(&ctx->ast, port_type, tok.value, bitrange ? 1 : 0, &bitrange);
+
+no_match:
+    backtrack(ctx, BT_PORT_DECL, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_port_list(ParseCtx * ctx)
+{
+    size_t mark = ast_mark(&ctx->ast);
+    int leading_comma = 0;
+    while (1) {
+        NodeId port_decl = parse_port_decl(ctx, leading_comma);
+        if (!port_decl)
+            break;
+        ast_push(&ctx->ast, port_decl);
+        leading_comma = 1;
+    }
+    return ast_finish(&ctx->ast, AST_PORT_LIST, 0, mark);
+}
+
+static NodeId
+parse_index_uncached(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    Token tok1, tok2;
+    tok1 = next_token(ctx);
+    if (tok1.type != TOK_IDENT)     goto no_match;
+    if (next_token(ctx).type != '[')   goto no_match;
+    tok2 = next_token(ctx);
+    if (tok2.type != TOK_NUMBER)    goto no_match;
+    if (next_token(ctx).type != ']')   goto no_match;
+
+    NodeId ident = ast_leaf(&ctx->ast, AST_IDENT, tok1.value);
+    NodeId index = ast_leaf(&ctx->ast, AST_NUMBER, tok2.value);
+    return ast_new(&ctx->ast, AST_INDEX, 0, 2, (NodeId[]) { ident, index });
+
+no_match:
+    backtrack(ctx, BT_INDEX, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_lvalue_uncached(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    NodeId index = parse_index(ctx);
+    if (index) return index;
+    Token tok = next_token(ctx);
+    if (tok.type != TOK_IDENT) goto no_match;
+
+    return ast_leaf(&ctx->ast, AST_IDENT, tok.value);
+
+no_match:
+    backtrack(ctx, BT_LVALUE, saved_pos);
+    return AST_NULL;
+}
+
+static TokenType
+peek_token(ParseCtx * ctx)
+{
+    return ctx->toks.types[ctx->tok_pos];
+}
+
+// Binary operator precedence, loosest first (IEEE 1364-2005 5.1.2)
+typedef enum {
+    PREC_NONE=0,
+    PREC_TERNARY,
+    PREC_LOGICAL_OR,
+    PREC_LOGICAL_AND,
+    PREC_BITWISE_OR,
+    PREC_BITWISE_XOR,
+    PREC_BITWISE_AND,
+    PREC_EQUALITY,
+    PREC_RELATIONAL,
+    PREC_SHIFT,
+    PREC_ADDITIVE,
+    PREC_MULTIPLICATIVE,
+    PREC_POWER,
+} Precedence;
+
+typedef struct {
+    AstNodeType type;
+    Precedence prec;
+} BinaryOp;
+
+static BinaryOp
+binary_op(int tok_type)
+{
+    switch (tok_type) {
+        case '?':               return (BinaryOp) { AST_TERNARY,       PREC_TERNARY        };
+        case TOK_LOGICAL_OR:    return (BinaryOp) { AST_LOGICAL_OR,    PREC_LOGICAL_OR     };
+        case TOK_LOGICAL_AND:   return (BinaryOp) { AST_LOGICAL_AND,   PREC_LOGICAL_AND    };
+        case '|':               return (BinaryOp) { AST_BITWISE_OR,    PREC_BITWISE_OR     };
+        case '^':               return (BinaryOp) { AST_BITWISE_XOR,   PREC_BITWISE_XOR    };
+        case TOK_XNOR:          return (BinaryOp) { AST_BITWISE_XNOR,  PREC_BITWISE_XOR    };
+        case '&':               return (BinaryOp) { AST_BITWISE_AND,   PREC_BITWISE_AND    };
+        case TOK_EQ:            return (BinaryOp) { AST_EQ,            PREC_EQUALITY       };
+        case TOK_NEQ:           return (BinaryOp) { AST_NEQ,           PREC_EQUALITY       };
+        case TOK_CASE_EQ:       return (BinaryOp) { AST_CASE_EQ,       PREC_EQUALITY       };
+        case TOK_CASE_NEQ:      return (BinaryOp) { AST_CASE_NEQ,      PREC_EQUALITY       };
+        case '<':               return (BinaryOp) { AST_LT,            PREC_RELATIONAL     };
+        case TOK_LTE:           return (BinaryOp) { AST_LTE,           PREC_RELATIONAL     };
+        case '>':               return (BinaryOp) { AST_GT,            PREC_RELATIONAL     };
+        case TOK_GTE:           return (BinaryOp) { AST_GTE,           PREC_RELATIONAL     };
+        case TOK_LSH:           return (BinaryOp) { AST_LSH,           PREC_SHIFT          };
+        case TOK_RSH:           return (BinaryOp) { AST_RSH,           PREC_SHIFT          };
+        case TOK_ALSH:          return (BinaryOp) { AST_ALSH,          PREC_SHIFT          };
+        case TOK_ARSH:          return (BinaryOp) { AST_ARSH,          PREC_SHIFT          };
+        case '+':               return (BinaryOp) { AST_ADD,           PREC_ADDITIVE       };
+        case '-':               return (BinaryOp) { AST_SUB,           PREC_ADDITIVE       };
+        case '*':               return (BinaryOp) { AST_MUL,           PREC_MULTIPLICATIVE };
+        case '/':               return (BinaryOp) { AST_DIV,           PREC_MULTIPLICATIVE };
+        case '%':               return (BinaryOp) { AST_MOD,           PREC_MULTIPLICATIVE };
+        case TOK_POW:           return (BinaryOp) { AST_POW,           PREC_POWER          };
+        default:                return (BinaryOp) { .prec = PREC_NONE };
+    }
+}
+
+static AstNodeType
+unary_op(int tok_type)
+{
+    switch (tok_type) {
+        case '+':       return AST_UNARY_PLUS;
+        case '-':       return AST_UNARY_MINUS;
+        case '!':       return AST_LOGICAL_NOT;
+        case '~':       return AST_BITWISE_INVERT;
+        case '&':       return AST_REDUCE_AND;
+        case TOK_NAND:  return AST_REDUCE_NAND;
+        case '|':       return AST_REDUCE_OR;
+        case TOK_NOR:   return AST_REDUCE_NOR;
+        case '^':       return AST_REDUCE_XOR;
+        case TOK_XNOR:  return AST_REDUCE_XNOR;
+        default:        return AST_NULL_NODE;
+    }
+}
+
+// Expressions are parsed by precedence climbing on an explicit stack, so
+// that neither a long chain like a | b | c | ... nor deep nesting like
+// ((((a)))) or ~~~~a can run out of C stack. Operators at the same level are
+// folded into lhs by a loop, so a chain takes linear time and a stack depth
+// bounded by the number of precedence levels. All binary operators are
+// left-associative; ?: is right-associative.
+//
+// Each frame is one call of the recursive parser this replaces: an EXPR
+// frame parses operators of at least min_prec, a PREFIX frame applies one
+// unary operator and a PRIMARY frame parses an operand. A frame that needs
+// a subexpression pushes a frame for it and is resumed with the result once
+// that frame has been popped. Every frame backtracks to start on failure.
+
+typedef enum {
+    FRAME_EXPR,
+    FRAME_PREFIX,
+    FRAME_PRIMARY,
+} FrameKind;
+
+typedef enum {
+    FRAME_START=0,
+    EXPR_LHS,               // waiting for the first operand
+    EXPR_RHS,               // waiting for the right operand of op
+    EXPR_THEN,              // waiting for the middle of ?:
+    EXPR_ELSE,              // waiting for the end of ?:
+    PREFIX_OPERAND,
+    PRIMARY_INDEX,          // waiting for the index of lhs[...]
+    PRIMARY_PAREN,
+} FrameState;
+
+typedef struct ExprFrame {
+    uint8_t kind;
+    uint8_t state;
+    uint8_t min_prec;       // FRAME_EXPR
+    uint8_t op;             // AstNodeType of the pending operator
+    size_t start;
+    size_t op_pos;          // FRAME_EXPR: where the pending operator is
+    NodeId lhs;             // FRAME_EXPR: left operand, FRAME_PRIMARY: indexed name
+    NodeId mid;             // FRAME_EXPR: middle of ?:
+} ExprFrame;
+
+static void
+push_frame(ParseCtx * ctx, FrameKind kind, FrameState state, Precedence min_prec)
+{
+    ExprFrame f = { .kind = kind, .state = state, .min_prec = min_prec, .start = ctx->tok_pos };
+    arrput(ctx->expr_stack, f);
+}
+
+// An operand is one PREFIX frame per unary operator, innermost on top, and
+// a PRIMARY frame.
+static void
+push_operand(ParseCtx * ctx)
+{
+    AstNodeType op;
+    while ((op = unary_op(peek_token(ctx))) != AST_NULL_NODE) {
+        push_frame(ctx, FRAME_PREFIX, PREFIX_OPERAND, PREC_NONE);
+        arrlast(ctx->expr_stack).op = op;
+        next_token(ctx);
+    }
+    push_frame(ctx, FRAME_PRIMARY, FRAME_START, PREC_NONE);
+}
+
+// The resume_* functions continue the frame on top of the stack with the
+// result of the frame it pushed in *ret. They return true when the frame
+// is done and its own result is in *ret.
+
+static bool
+resume_expr(ParseCtx * ctx, NodeId * ret)
+{
+    ExprFrame * f = &arrlast(ctx->expr_stack);
+    switch (f->state) {
+        case FRAME_START:
+            f->state = EXPR_LHS;
+            push_operand(ctx);
+            return false;
+        case EXPR_LHS:
+            if (!*ret)
+                return true;
+            f->lhs = *ret;
+            break;
+        case EXPR_RHS:
+            if (!*ret)
+                goto give_back_op;
+            f->lhs = ast_new(&ctx->ast, f->op, 0, 2, (NodeId[]) { f->lhs, *ret });
+            break;
+        case EXPR_THEN:
+            if (!*ret || next_token(ctx).type != ':')
+                goto give_back_op;
+            f->mid = *ret;
+            f->state = EXPR_ELSE;
+            push_frame(ctx, FRAME_EXPR, FRAME_START, PREC_TERNARY);
+            return false;
+        case EXPR_ELSE:
+            if (!*ret)
+                goto give_back_op;
+            f->lhs = ast_new(&ctx->ast, AST_TERNARY, 0, 3, (NodeId[]) { f->lhs, f->mid, *ret });
+            break;
+        default:
+            assert(0);
+    }
+
+    f->op_pos = ctx->tok_pos;
+    BinaryOp op = binary_op(next_token(ctx).type);
+    if (op.prec == PREC_NONE || op.prec < f->min_prec)
+        goto give_back_op;
+    f->op = op.type;
+    if (op.type == AST_TERNARY) {
+        f->state = EXPR_THEN;
+        push_frame(ctx, FRAME_EXPR, FRAME_START, PREC_TERNARY);
+    } else {
+        f->state = EXPR_RHS;
+        push_frame(ctx, FRAME_EXPR, FRAME_START, op.prec + 1);
+    }
+    return false;
+
+give_back_op:
+    // lhs stands on its own; the operator is left for an outer frame
+    backtrack(ctx, BT_EXPR, f->op_pos);
+    *ret = f->lhs;
+    return true;
+}
+
+static bool
+resume_primary(ParseCtx * ctx, NodeId * ret)
+{
+    ExprFrame * f = &arrlast(ctx->expr_stack);
+    NodeId expr = *ret;
+    switch (f->state) {
+        case FRAME_START: {
+                Token tok = next_token(ctx);
+                if (tok.type == TOK_LITERAL) {
+                    *ret = ast_leaf(&ctx->ast, AST_LITERAL, tok.value);
+                    return true;
+                }
+                if (tok.type == TOK_NUMBER) {
+                    *ret = ast_leaf(&ctx->ast, AST_NUMBER, tok.value);
+                    return true;
+                }
+                if (tok.type == '(') {
+                    f->state = PRIMARY_PAREN;
+                    push_frame(ctx, FRAME_EXPR, FRAME_START, PREC_TERNARY);
+                    return false;
+                }
+                if (tok.type != TOK_IDENT)
+                    goto no_match;
+                f->lhs = ast_leaf(&ctx->ast, AST_IDENT, tok.value);
+                if (peek_token(ctx) != '[') {
+                    *ret = f->lhs;
+                    return true;
+                }
+                next_token(ctx);
+                f->state = PRIMARY_INDEX;
+                push_frame(ctx, FRAME_EXPR, FRAME_START, PREC_TERNARY);
+                return false;
+            }
+        case PRIMARY_INDEX:
+            if (!expr)                          goto no_match;
+            if (next_token(ctx).type != ']')    goto no_match;
+            *ret = ast_new(&ctx->ast, AST_INDEX, 0, 2, (NodeId[]) { f->lhs, expr });
+            return true;
+        case PRIMARY_PAREN:
+            if (!expr)                          goto no_match;
+            if (next_token(ctx).type != ')')    goto no_match;
+            *ret = ast_new(&ctx->ast, AST_PAREN, 0, 1, &expr);
+            return true;
+        default:
+            assert(0);
+    }
+
+no_match:
+    backtrack(ctx, BT_PRIMARY, f->start);
+    *ret = AST_NULL;
+    return true;
+}
+
+// Runs frames until the one pushed here is done. Full expressions and
+// primaries are memoized like the rules of the recursive parser.
+static NodeId
+parse_expr(ParseCtx * ctx)
+{
+    size_t base = arrlenu(ctx->expr_stack);
+    NodeId ret = AST_NULL;
+    push_frame(ctx, FRAME_EXPR, FRAME_START, PREC_TERNARY);
+    while (arrlenu(ctx->expr_stack) > base) {
+        ExprFrame * f = &arrlast(ctx->expr_stack);
+        Rule rule = f->kind == FRAME_PRIMARY ? RULE_PRIMARY : RULE_EXPR;
+        bool memoized = f->kind == FRAME_PRIMARY || (f->kind == FRAME_EXPR && f->min_prec == PREC_TERNARY);
+        if (f->state == FRAME_START && memoized && memo_lookup(ctx, rule, &ret)) {
+            arrpop(ctx->expr_stack);
+            continue;
+        }
+
+        bool done;
+        switch (f->kind) {
+            case FRAME_EXPR:
+                done = resume_expr(ctx, &ret);
+                break;
+            case FRAME_PREFIX:
+                if (ret)
+                    ret = ast_new(&ctx->ast, f->op, 0, 1, &ret);
+                else
+                    backtrack(ctx, BT_UNARY, f->start);
+                done = true;
+                break;
+            case FRAME_PRIMARY:
+                done = resume_primary(ctx, &ret);
+                break;
+            default:
+                assert(0);
+        }
+        if (!done)
+            continue;
+        f = &arrlast(ctx->expr_stack);
+        if (memoized)
+            memo_store(ctx, rule, f->start, ret);
+        arrpop(ctx->expr_stack);
+    }
+    return ret;
+}
+
+static NodeId
+parse_blocking_non_blocking_uncached(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    // TODO: inter- and intra-assignment delays
+    NodeId dst = parse_lvalue(ctx);
+    if (!dst)                       goto no_match;
+    Token tok = next_token(ctx);
+    AstNodeType node_type;
+    if      (tok.type == TOK_LTE)   node_type = AST_NON_BLOCKING;
+    else if (tok.type == '=')       node_type = AST_BLOCKING;
+    else                            goto no_match;
+    NodeId expr = parse_expr(ctx);
+    if (!expr)                      goto no_match;
+    if (next_token(ctx).type != ';')   goto no_match;
+
+    return ast_new(&ctx->ast, node_type, 0, 2, (NodeId[]) { dst, expr });
+
+no_match:
+    backtrack(ctx, BT_BLOCKING_NON_BLOCKING, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_else(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    if (next_token(ctx).type != TOK_ELSE) goto no_match;
+    NodeId stmt = parse_procedural_stmt(ctx);
+    if (!stmt) goto no_match;
+    return stmt;
+
+no_match:
+    backtrack(ctx, BT_ELSE, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_if_stmt_uncached(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    if (next_token(ctx).type != TOK_IF)    goto no_match;
+    if (next_token(ctx).type != '(')       goto no_match;
+    NodeId cond = parse_expr(ctx);
+    if (!cond)                          goto no_match;
+    if (next_token(ctx).type != ')')       goto no_match;
+    NodeId stmt = parse_procedural_stmt(ctx);
+    if (!stmt)                          goto no_match;
+    NodeId else_node = parse_else(ctx);
+
+    // TODO: should else-if be handled specifically?
+    return ast_new(&ctx->ast, AST_IF, 0, 3, (NodeId[]) { cond, stmt, else_node });
+
+no_match:
+    backtrack(ctx, BT_IF_STMT, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_delay(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    if (next_token(ctx).type != '#')   goto no_match;
+    Token tok = next_token(ctx);
+    if (tok.type != TOK_NUMBER)     goto no_match;
+
+    return ast_leaf(&ctx->ast, AST_DELAY, tok.value);
+
+no_match:
+    backtrack(ctx, BT_DELAY, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_dpi(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    if (next_token(ctx).type != '$')   goto no_match;
+    Token tok = next_token(ctx);
+    if (tok.type != TOK_IDENT)      goto no_match;
+    if (next_token(ctx).type != '(')   goto no_match;
+    // TODO: arguments
+    if (next_token(ctx).type != ')')   goto no_match;
+
+    return ast_leaf(&ctx->ast, AST_DPI, tok.value);
+
+no_match:
+    backtrack(ctx, BT_DPI, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_block_uncached(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+    size_t mark = ast_mark(&ctx->ast);
+
+    if (next_token(ctx).type != TOK_BEGIN)     goto no_match;
+    while (1) {
+        NodeId stmt = parse_procedural_stmt(ctx);
+        if (!stmt)
+            break;
+        ast_push(&ctx->ast, stmt);
+    }
+    if (next_token(ctx).type != TOK_END)       goto no_match;
+    return ast_finish(&ctx->ast, AST_BLOCK, 0, mark);
+
+no_match:
+    ast_unwind(&ctx->ast, mark);
+    backtrack(ctx, BT_BLOCK, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_empty_stmt(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+    if (next_token(ctx).type != ';') goto no_match;
+no_match:
+    backtrack(ctx, BT_EMPTY_STMT, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_procedural_stmt_uncached(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    NodeId stmt;
+    if      (stmt = parse_block(ctx))                  ;
+    else if (stmt = parse_if_stmt(ctx))                ;
+    else if (stmt = parse_blocking_non_blocking(ctx))  ;
+    else if (stmt = parse_delay(ctx))                  ;
+    else if (stmt = parse_dpi(ctx))                    ;
+    else if (stmt = parse_empty_stmt(ctx))             ;
+    else                                            goto no_match;
+
+    return stmt;
+
+no_match:
+    backtrack(ctx, BT_PROCEDURAL_STMT, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_sensitivity_list(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    // TODO: this is hard-coded
+    if (next_token(ctx).type != TOK_POSEDGE)   goto no_match;
+    if (next_token(ctx).type != TOK_IDENT)     goto no_match;
+    if (next_token(ctx).type != TOK_OR)        goto no_match;
+    if (next_token(ctx).type != TOK_POSEDGE)   goto no_match;
+    if (next_token(ctx).type != TOK_IDENT)     goto no_match;
+
+    return ast_leaf(&ctx->ast, AST_SENSITIVITY_LIST, 0);
+
+no_match:
+    backtrack(ctx, BT_SENSITIVITY_LIST, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_always(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    if (next_token(ctx).type != TOK_ALWAYS)    goto no_match;
+    if (next_token(ctx).type != '@')           goto no_match;
+    if (next_token(ctx).type != '(')           goto no_match;
+    NodeId sensitivity_list = parse_sensitivity_list(ctx);
+    if (!sensitivity_list)                  goto no_match;
+    if (next_token(ctx).type != ')')           goto no_match;
+    NodeId stmt = parse_block(ctx);
+
+    return ast_new(&ctx->ast, AST_ALWAYS, 0, 2, (NodeId[]) { sensitivity_list, stmt });
+
+no_match:
+    backtrack(ctx, BT_ALWAYS, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_initial(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    if (next_token(ctx).type != TOK_INITIAL) goto no_match;
+    NodeId stmt = parse_block(ctx);
+
+    return ast_new(&ctx->ast, AST_INITIAL, 0, 1, &stmt);
+
+no_match:
+    backtrack(ctx, BT_INITIAL, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_port_map(ParseCtx * ctx, int leading_comma)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    if (leading_comma && next_token(ctx).type != ',')      goto no_match;
+
+    Token tok1, tok2;
+    if (next_token(ctx).type != '.')   goto no_match;
+    tok1 = next_token(ctx);
+    if (tok1.type != TOK_IDENT)     goto no_match;
+    if (next_token(ctx).type != '(')   goto no_match;
+    NodeId rchild = parse_expr(ctx);
+    if (!rchild)                    goto no_match;
+    if (next_token(ctx).type != ')')   goto no_match;
+
+    NodeId lchild = ast_leaf(&ctx->ast, AST_IDENT, tok1.value);
+    return ast_new(&ctx->ast, AST_PORT_MAP, 0, 2, (NodeId[]) { lchild, rchild });
+
+no_match:
+    backtrack(ctx, BT_PORT_MAP, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_port_map_list(ParseCtx * ctx)
+{
+    size_t mark = ast_mark(&ctx->ast);
+
+    int leading_comma = 0;
+    while (1) {
+        NodeId port_map = parse_port_map(ctx, leading_comma);
+        if (!port_map)
+            break;
+        ast_push(&ctx->ast, port_map);
+        leading_comma = 1;
+    }
+
+    return ast_finish(&ctx->ast, AST_PORT_MAP_LIST, 0, mark);
+}
+
+static NodeId
+parse_instantiation(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    Token tok1, tok2;
+    tok1 = next_token(ctx); // module name
+    if (tok1.type != TOK_IDENT)     goto no_match;
+    tok2 = next_token(ctx); // instance name
+    if (tok2.type != TOK_IDENT)     goto no_match;
+    if (next_token(ctx).type != '(')   goto no_match;
+    NodeId port_map_list = parse_port_map_list(ctx);
+    if (next_token(ctx).type != ')')   goto no_match;
+    if (next_token(ctx).type != ';')   goto no_match;
+
+    NodeId module_name = ast_leaf(&ctx->ast, AST_IDENT, tok1.value);
+    NodeId instance_name = ast_leaf(&ctx->ast, AST_IDENT, tok2.value);
+    return ast_new(&ctx->ast, AST_INSTANTIATION, 0, 3, (NodeId[]) { module_name, instance_name, port_map_list });
+
+no_match:
+    backtrack(ctx, BT_INSTANTIATION, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_signal_decl(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+    size_t mark = ast_mark(&ctx->ast);
+
+    Token tok = next_token(ctx);
+    AstNodeType signal_type;
+    if      (tok.type == TOK_WIRE)  signal_type = AST_WIRE_DECL;
+    else if (tok.type == TOK_REG)   signal_type = AST_REG_DECL;
+    else                            goto no_match;
+
+    NodeId bitrange = parse_bitrange(ctx);
+    tok = next_token(ctx);
+    // TODO: multiple declaration: wire a, b, c;
+    if (tok.type != TOK_IDENT)      goto no_match;
+
+    ast_push(&ctx->ast, bitrange);
+    NodeId array;
+    while (array = parse_bitrange(ctx)) {
+        ast_push(&ctx->ast, array);
+    }
+    if (next_token(ctx).type != ';')   goto no_match;
+
+    return ast_finish(&ctx->ast, signal_type, tok.value, mark);
+
+no_match:
+    ast_unwind(&ctx->ast, mark);
+    backtrack(ctx, BT_SIGNAL_DECL, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_param_decl(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+    // TODO
+no_match:
+    backtrack(ctx, BT_PARAM_DECL, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_assign(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    if (next_token(ctx).type != TOK_ASSIGN)    goto no_match;
+    Token tok = next_token(ctx);
+    if (tok.type != TOK_IDENT)              goto no_match;
+    if (next_token(ctx).type != '=')           goto no_match;
+    NodeId expr = parse_expr(ctx);
+    if (!expr)                              goto no_match;
+    if (next_token(ctx).type != ';')           goto no_match;
+
+    NodeId dst = ast_leaf(&ctx->ast, AST_IDENT, tok.value);
+    return ast_new(&ctx->ast, AST_CONT_ASSIGN, 0, 2, (NodeId[]) { dst, expr });
+
+no_match:
+    backtrack(ctx, BT_ASSIGN, saved_pos);
+    return AST_NULL;
+}
+
+static NodeId
+parse_module_body(ParseCtx * ctx)
+{
+    size_t mark = ast_mark(&ctx->ast);
+    // everything an item adds is dropped again when streaming to a sink
+    size_t nodes = arrlenu(ctx->ast.nodes);
+    size_t kids = arrlenu(ctx->ast.kids);
+
+    while (1) {
+        NodeId stmt;
+        if      (stmt = parse_signal_decl(ctx))    ;
+        else if (stmt = parse_param_decl(ctx))     ;
+        else if (stmt = parse_assign(ctx))         ;
+        else if (stmt = parse_instantiation(ctx))  ;
+        else if (stmt = parse_always(ctx))         ;
+        else if (stmt = parse_initial(ctx))        ;
+        else                                    break;
+        if (ctx->sink) {
+            ctx->sink->item(ctx->sink->user, &ctx->ast, stmt);
+            arrsetlen(ctx->ast.nodes, nodes);
+            arrsetlen(ctx->ast.kids, kids);
+            continue;
+        }
+        ast_push(&ctx->ast, stmt);
+    }
+
+    return ast_finish(&ctx->ast, AST_MODULE_BODY, 0, mark);
+}
+
+// Nets are looked up by name and bit while a netlist body is parsed. A
+// slot is only trusted if it points at a net of the current module that
+// still has its name, so nothing is cleared between modules and a cell
+// that fails half way can simply drop the nets it made.
+typedef struct NetSlot {
+    Symbol name;
+    int32_t bit;
+    uint32_t net1;          // net + 1, 0 = empty
+} NetSlot;
+
+static uint32_t
+net_hash(Symbol name, int32_t bit)
+{
+    return (name * 0x9E3779B1u) ^ ((uint32_t) bit * 0x85EBCA77u);
+}
+
+static bool
+net_slot_live(const Netlist * nl, const NetSlot * slot, uint32_t first_net)
+{
+    uint32_t net = slot->net1 - 1;
+    return slot->net1 && net >= first_net && net < arrlenu(nl->nets)
+        && nl->nets[net].name == slot->name && nl->nets[net].bit == slot->bit;
+}
+
+static void
+grow_net_slots(ParseCtx * ctx, uint32_t first_net)
+{
+    const Netlist * nl = &ctx->ast.netlist;
+    NetSlot * old = ctx->net_slots;
+    uint32_t old_size = old ? ctx->net_mask + 1 : 0;
+    uint32_t live = 0;
+    for (uint32_t i = 0; i < old_size; i++)
+        live += net_slot_live(nl, &old[i], first_net);
+    uint32_t size = 1024;
+    while (size < 4 * live)
+        size *= 2;
+    ctx->net_slots = calloc(size, sizeof(*ctx->net_slots));
+    if (ctx->net_slots == NULL)
+        die("error: out of memory for %u nets\n", live);
+    ctx->net_mask = size - 1;
+    ctx->net_slots_used = live;
+    for (uint32_t i = 0; i < old_size; i++) {
+        if (!net_slot_live(nl, &old[i], first_net))
+            continue;
+        uint32_t h = net_hash(old[i].name, old[i].bit) & ctx->net_mask;
+        while (ctx->net_slots[h].net1)
+            h = (h + 1) & ctx->net_mask;
+        ctx->net_slots[h] = old[i];
+    }
+    free(old);
+}
+
+// Returns the net of the current module, which starts at first_net, with
+// this name and bit, adding it if there is none yet.
+static uint32_t
+netlist_net(ParseCtx * ctx, uint32_t first_net, Symbol name, int32_t bit)
+{
+    Netlist * nl = &ctx->ast.netlist;
+    if (ctx->net_slots == NULL || 2 * (ctx->net_slots_used + 1) > ctx->net_mask + 1)
+        grow_net_slots(ctx, first_net);
+    uint32_t h = net_hash(name, bit) & ctx->net_mask;
+    NetSlot * reuse = NULL;
+    for (;; h = (h + 1) & ctx->net_mask) {
+        NetSlot * slot = &ctx->net_slots[h];
+        if (!slot->net1)
+            break;
+        if (!net_slot_live(nl, slot, first_net)) {
+            if (!reuse)
+                reuse = slot;
+        } else if (slot->name == name && slot->bit == bit) {
+            return slot->net1 - 1;
+        }
+    }
+    if (!reuse) {
+        reuse = &ctx->net_slots[h];
+        ctx->net_slots_used++;
+    }
+    arrput(nl->nets, ((Net) { .name = name, .bit = bit }));
+    *reuse = (NetSlot) { name, bit, arrlenu(nl->nets) };
+    return arrlenu(nl->nets) - 1;
+}
+
+// cell inst ( .pin(net), ... ) ; where every net is a name, one bit of a
+// name, a constant or nothing, straight into the netlist. Anything else is
+// left to parse_instantiation().
+static bool
+parse_netlist_cell(ParseCtx * ctx, uint32_t first_net)
+{
+    const uint16_t * types = ctx->toks.types;
+    const uint32_t * values = ctx->toks.values;
+    Netlist * nl = &ctx->ast.netlist;
+    size_t p = ctx->tok_pos;
+    size_t npins = arrlenu(nl->pin_names);
+    size_t nnets = arrlenu(nl->nets);
+
+    if (types[p] != TOK_IDENT || types[p + 1] != TOK_IDENT || types[p + 2] != '(')
+        return false;
+    Cell cell = { values[p], values[p + 1], npins };
+    p += 3;
+    while (types[p] != ')') {
+        if (types[p] != '.' || types[p + 1] != TOK_IDENT || types[p + 2] != '(')
+            goto no_match;
+        Symbol pin = values[p + 1];
+        p += 3;
+        uint32_t net = NET_NONE;
+        if (types[p] == TOK_IDENT) {
+            Symbol name = values[p++];
+            int32_t bit = NET_WHOLE;
+            if (types[p] == '[' && types[p + 1] == TOK_NUMBER && types[p + 2] == ']') {
+                int64_t n = literal_int64(&ctx->ast.literals, values[p + 1]);
+                if (n < 0 || n > INT32_MAX)
+                    goto no_match;
+                bit = n;
+                p += 3;
+            }
+            net = netlist_net(ctx, first_net, name, bit);
+        } else if (types[p] == TOK_NUMBER || types[p] == TOK_LITERAL) {
+            // constants are nets named by their text, so all ties to the
+            // same value share one
+            char text[64];
+            size_t len = format_literal(&ctx->ast.literals, values[p], text, sizeof(text));
+            if (len >= sizeof(text))
+                goto no_match;
+            net = netlist_net(ctx, first_net, intern(&ctx->symtab, text, len), NET_WHOLE);
+            p++;
+        }
+        if (types[p] != ')')
+            goto no_match;
+        arrput(nl->pin_names, pin);
+        arrput(nl->pin_nets, net);
+        p++;
+        if (types[p] == ',' && types[p + 1] == '.')
+            p++;
+        else if (types[p] != ')')
+            goto no_match;
+    }
+    if (types[p + 1] != ';')
+        goto no_match;
+    arrput(nl->cells, cell);
+    ctx->tok_pos = p + 2;
+    if (p + 1 > ctx->furthest)
+        ctx->furthest = p + 1;
+    return true;
+
+no_match:
+    if (p > ctx->furthest)
+        ctx->furthest = p;
+    count_backtrack(ctx, BT_NETLIST_CELL, p + 1 - ctx->tok_pos);
+    arrsetlen(nl->pin_names, npins);
+    arrsetlen(nl->pin_nets, npins);
+    arrsetlen(nl->nets, nnets);
+    return false;
+}
+
+// Netlist mode's parse_module_body. Plain instances go into the netlist,
+// anything else becomes a kid of the AST_NETLIST_BODY as usual. Once the
+// body is known to end at endmodule, the pins of each net are gathered.
+static NodeId
+parse_netlist_body(ParseCtx * ctx, NodeId port_list)
+{
+    Netlist * nl = &ctx->ast.netlist;
+    NetlistBody body = { .cell_begin = arrlenu(nl->cells), .net_begin = arrlenu(nl->nets) };
+    uint32_t pin_begin = arrlenu(nl->pin_names);
+    size_t mark = ast_mark(&ctx->ast);
+
+    for (uint32_t i = 0; i < ast_nkids(&ctx->ast, port_list); i++)
+        netlist_net(ctx, body.net_begin, ast_value(&ctx->ast, ast_kid(&ctx->ast, port_list, i)), NET_WHOLE);
+    body.nports = arrlenu(nl->nets) - body.net_begin;
+
+    while (1) {
+        if (parse_netlist_cell(ctx, body.net_begin))
+            continue;
+        NodeId stmt;
+        if      (stmt = parse_signal_decl(ctx))    ;
+        else if (stmt = parse_param_decl(ctx))     ;
+        else if (stmt = parse_assign(ctx))         ;
+        else if (stmt = parse_instantiation(ctx))  ;
+        else if (stmt = parse_always(ctx))         ;
+        else if (stmt = parse_initial(ctx))        ;
+        else                                    break;
+        ast_push(&ctx->ast, stmt);
+    }
+    if (peek_token(ctx) != TOK_ENDMODULE) {
+        ast_unwind(&ctx->ast, mark);
+        arrsetlen(nl->cells, body.cell_begin);
+        arrsetlen(nl->pin_names, pin_begin);
+        arrsetlen(nl->pin_nets, pin_begin);
+        arrsetlen(nl->nets, body.net_begin);
+        return AST_NULL;
+    }
+    body.cell_end = arrlenu(nl->cells);
+    body.net_end = arrlenu(nl->nets);
+
+    // counting sort of the pins by net, using Net.pins first as a count,
+    // then as a cursor that ends up at the next net's start
+    Net * nets = nl->nets;
+    uint32_t base = arrlenu(nl->net_pins);
+    uint32_t at = base;
+    uint32_t npins = arrlenu(nl->pin_names);
+    for (uint32_t n = body.net_begin; n < body.net_end; n++)
+        nets[n].pins = 0;
+    for (uint32_t p = pin_begin; p < npins; p++)
+        if (nl->pin_nets[p] != NET_NONE)
+            nets[nl->pin_nets[p]].pins++;
+    for (uint32_t n = body.net_begin; n < body.net_end; n++) {
+        uint32_t count = nets[n].pins;
+        nets[n].pins = at;
+        at += count;
+    }
+    arrsetlen(nl->net_pins, at);
+    for (uint32_t p = pin_begin; p < npins; p++)
+        if (nl->pin_nets[p] != NET_NONE)
+            nl->net_pins[nets[nl->pin_nets[p]].pins++] = p;
+    for (uint32_t n = body.net_end; n-- > body.net_begin + 1;)
+        nets[n].pins = nets[n - 1].pins;
+    if (body.net_end > body.net_begin)
+        nets[body.net_begin].pins = base;
+
+    arrput(nl->bodies, body);
+    return ast_finish(&ctx->ast, AST_NETLIST_BODY, arrlenu(nl->bodies) - 1, mark);
+}
+
+// The lazy stand-in for parse_module_body: saves the tokens up to the
+// endmodule for expand_module_body(), and collects the module names of
+// anything shaped like an instantiation, i.e. IDENT IDENT ( at the start
+// of a statement.
+static NodeId
+skip_module_body(ParseCtx * ctx)
+{
+    const uint16_t * types = ctx->toks.types;
+    const uint32_t * values = ctx->toks.values;
+    size_t mark = ast_mark(&ctx->ast);
+    size_t begin = ctx->tok_pos;
+    size_t end = begin;
+    bool stmt_start = true;
+    while (types[end] != TOK_ENDMODULE && types[end] != TOK_MODULE && types[end] != TOK_EOF) {
+        if (stmt_start && types[end] == TOK_IDENT && types[end + 1] == TOK_IDENT && types[end + 2] == '(')
+            ast_push(&ctx->ast, ast_leaf(&ctx->ast, AST_IDENT, values[end]));
+        stmt_start = types[end] == ';';
+        end++;
+    }
+    if (end > ctx->furthest)
+        ctx->furthest = end;
+    if (types[end] != TOK_ENDMODULE) {
+        ast_unwind(&ctx->ast, mark);
+        return AST_NULL;
+    }
+
+    Ast * ast = &ctx->ast;
+    TokenRange range = { arrlenu(ast->lazy_types), arrlenu(ast->lazy_types) + (end - begin) };
+    if (end > begin) {
+        memcpy(arraddnptr(ast->lazy_types, end - begin), &types[begin], (end - begin) * sizeof(*types));
+        memcpy(arraddnptr(ast->lazy_values, end - begin), &values[begin], (end - begin) * sizeof(*values));
+        for (size_t i = begin; i < end; i++)
+            arrput(ast->lazy_offsets, token_offset(&ctx->toks, i));
+    }
+    arrput(ast->lazy, range);
+    ctx->tok_pos = end;
+    return ast_finish(ast, AST_LAZY_BODY, arrlenu(ast->lazy) - 1, mark);
+}
+
+static NodeId
+parse_module_def(ParseCtx * ctx)
+{
+    size_t saved_pos = ctx->tok_pos;
+
+    Token tok;
+    if (next_token(ctx).type != TOK_MODULE)            goto no_match;
+    if ((tok = next_token(ctx)).type != TOK_IDENT)     goto no_match;
+    if (next_token(ctx).type != '(')                   goto no_match;
+    NodeId port_list = parse_port_list(ctx);
+    if (next_token(ctx).type != ')')                   goto no_match;
+    if (next_token(ctx).type != ';')                   goto no_match;
+    if (ctx->sink)
+        ctx->sink->begin(ctx->sink->user, &ctx->ast, tok.value, port_list);
+    NodeId body;
+    if (ctx->sink)
+        body = parse_module_body(ctx);
+    else if (ctx->netlist)
+        body = parse_netlist_body(ctx, port_list);
+    else if (ctx->lazy)
+        body = skip_module_body(ctx);
+    else
+        body = parse_module_body(ctx);
+    if (!body)                                      goto no_match;
+    if (next_token(ctx).type != TOK_ENDMODULE)         goto no_match;
+
+    if (ctx->sink)
+        ctx->sink->end(ctx->sink->user, &ctx->ast, tok.value);
+    return ast_new(&ctx->ast, AST_MODULE_DEF, tok.value, 3, (NodeId[]) { AST_NULL, port_list, body });
+
+no_match:
+    backtrack(ctx, BT_MODULE_DEF, saved_pos);
+    return AST_NULL;
+}
+
+static void
+report_error(ParseCtx * ctx, size_t tok_pos, const char * message)
+{
+    Diagnostic diag = { .offset = token_offset(&ctx->toks, tok_pos), .message = message };
+    arrput(ctx->diags, diag);
+}
+
+// Panic-mode recovery: skip to just past the next endmodule, or to the next
+// module if that comes first, and carry on from there.
+static void
+resync(ParseCtx * ctx, size_t start)
+{
+    ctx->tok_pos = start + 1;
+    while (1) {
+        TokenType type = peek_token(ctx);
+        if (type == TOK_EOF || type == TOK_MODULE)
+            return;
+        ctx->tok_pos++;
+        if (type == TOK_ENDMODULE)
+            return;
+    }
+}
+
+ParseCtx
+init_parse_ctx(bool use_memo, bool lazy, bool netlist)
+{
+    return (ParseCtx) { .use_memo = use_memo, .lazy = lazy, .netlist = netlist };
+}
+
+// Parses the modules in ctx->toks onto the AST stack, appending their
+// spans and any errors, relative to the start of the tokens, to
+// ctx->spans and ctx->diags. A module that fails to parse is left out and
+// parsing resumes after it.
+static void
+parse_modules(ParseCtx * ctx)
+{
+    ctx->tok_pos = 0;
+    arena_reset(&ctx->arena);
+    ctx->memo = NULL;
+    // memo entries would outlive the items a sink drops
+    if (ctx->use_memo && !ctx->sink)
+        memo_init(ctx);
+
+    while (peek_token(ctx) != TOK_EOF) {
+        size_t start = ctx->tok_pos;
+        ctx->furthest = start;
+        NodeId module_def = parse_module_def(ctx);
+        if (module_def) {
+            size_t last = ctx->tok_pos - 1;
+            Span span = {
+                token_offset(&ctx->toks, start),
+                token_offset(&ctx->toks, last) + ctx->toks.lens[last]
+            };
+            ast_push(&ctx->ast, module_def);
+            arrput(ctx->spans, span);
+            continue;
+        }
+        if (peek_token(ctx) == TOK_MODULE)
+            report_error(ctx, ctx->furthest, "syntax error");
+        else
+            report_error(ctx, start, "expected module");
+        resync(ctx, start);
+    }
+    ctx->toks = (TokenList) {0};
+}
+
+// Parses tl into ctx->ast, replacing the previous result. The Ast takes
+// over the literals decoded by the tokenizer; the rest of tl stays with
+// the caller. Modules that fail to parse are reported in ctx->diags.
+void
+parse_tokens(ParseCtx * ctx, TokenList * tl)
+{
+    free_ast(&ctx->ast);
+    init_ast(&ctx->ast);
+    ctx->ast.literals = tl->literals;
+    tl->literals = (LiteralTable) {0};
+    ctx->toks = *tl;
+    arrsetlen(ctx->diags, 0);
+    arrsetlen(ctx->spans, 0);
+
+    Stopwatch sw = start_stopwatch();
+    size_t mark = ast_mark(&ctx->ast);
+    ctx->stats.tokens += num_tokens(tl);
+    parse_modules(ctx);
+    ctx->ast.root = ast_finish(&ctx->ast, AST_ROOT, 0, mark);
+    ctx->stats.nodes += arrlenu(ctx->ast.nodes);
+    stop_stopwatch(sw, &ctx->stats.times, PHASE_PARSE);
+}
+
+void
+parse_verilog(ParseCtx * ctx, Buffer input)
+{
+    Stopwatch sw = start_stopwatch();
+    TokenList tl = tokenize(input, &ctx->symtab);
+    stop_stopwatch(sw, &ctx->stats.times, PHASE_LEX);
+    parse_tokens(ctx, &tl);
+    free_tokens(&tl);
+}
+
+// Updates the result of the last parse_verilog() on ctx after edit, given
+// the whole edited input. Only the modules the edit touches, and the text
+// between them and their untouched neighbours, are lexed and parsed
+// again. The new AST_ROOT shares every other module's subtree with the
+// old one, whose nodes are left in place: call parse_verilog() now and
+// then to drop them.
+void
+reparse_edit(ParseCtx * ctx, Buffer input, Edit edit)
+{
+    size_t nmods = arrlenu(ctx->spans);
+    const Span * spans = ctx->spans;
+    size_t first = 0;
+    while (first < nmods && spans[first].end < edit.begin)
+        first++;
+    size_t last = first;
+    while (last < nmods && spans[last].begin <= edit.old_end)
+        last++;
+    size_t begin = first > 0 ? spans[first - 1].end : 0;
+    size_t old_end = last < nmods ? spans[last].begin : SIZE_MAX;
+    size_t end = last < nmods ? old_end - edit.old_end + edit.new_end : input.len;
+
+    // Lexing on into the next module's keyword checks that the edit did
+    // not open a comment or string that runs into it. If it did, the rest
+    // of the file has changed meaning and only a full parse will do.
+    size_t lex_end = last < nmods ? end + strlen("module") : end;
+    if (ctx->ast.nodes == NULL || lex_end > input.len) {
+        parse_verilog(ctx, input);
+        return;
+    }
+    Buffer region = copy_buffer(input.p + begin, lex_end - begin);
+    Stopwatch sw = start_stopwatch();
+    TokenList tl = tokenize(region, &ctx->symtab);
+    stop_stopwatch(sw, &ctx->stats.times, PHASE_LEX);
+    size_t n = num_tokens(&tl);
+    if (last < nmods) {
+        if (n < 2 || tl.types[n - 2] != TOK_MODULE || tl.offsets[n - 2] != end - begin) {
+            free_tokens(&tl);
+            free_buffer(&region);
+            parse_verilog(ctx, input);
+            return;
+        }
+        tl.types[n - 2] = TOK_EOF;
+    }
+
+    uint32_t lit_base = append_literals(&ctx->ast.literals, &tl.literals);
+    for (size_t i = 0; i < n; i++)
+        if (tl.types[i] == TOK_NUMBER || tl.types[i] == TOK_LITERAL)
+            tl.values[i] += lit_base;
+
+    Span * old_spans = ctx->spans;
+    Diagnostic * old_diags = ctx->diags;
+    ctx->spans = NULL;
+    ctx->diags = NULL;
+    sw = start_stopwatch();
+    size_t old_nodes = arrlenu(ctx->ast.nodes);
+    NodeId old_root = ctx->ast.root;
+    size_t mark = ast_mark(&ctx->ast);
+    for (size_t i = 0; i < first; i++)
+        ast_push(&ctx->ast, ast_kid(&ctx->ast, old_root, i));
+    ctx->toks = tl;
+    ctx->stats.tokens += n;
+    parse_modules(ctx);
+    for (size_t i = last; i < nmods; i++)
+        ast_push(&ctx->ast, ast_kid(&ctx->ast, old_root, i));
+    ctx->ast.root = ast_finish(&ctx->ast, AST_ROOT, 0, mark);
+    ctx->stats.nodes += arrlenu(ctx->ast.nodes) - old_nodes;
+    stop_stopwatch(sw, &ctx->stats.times, PHASE_PARSE);
+
+    // splice the new spans and errors in between the old ones
+    Span * new_spans = ctx->spans;
+    Diagnostic * new_diags = ctx->diags;
+    ctx->spans = NULL;
+    ctx->diags = NULL;
+    for (size_t i = 0; i < first; i++)
+        arrput(ctx->spans, old_spans[i]);
+    for (size_t i = 0; i < arrlenu(new_spans); i++)
+        arrput(ctx->spans, ((Span) { new_spans[i].begin + begin, new_spans[i].end + begin }));
+    for (size_t i = last; i < nmods; i++)
+        arrput(ctx->spans, ((Span) { old_spans[i].begin - edit.old_end + edit.new_end,
+                                     old_spans[i].end - edit.old_end + edit.new_end }));
+    for (size_t i = 0; i < arrlenu(old_diags); i++)
+        if (old_diags[i].offset < begin)
+            arrput(ctx->diags, old_diags[i]);
+    for (size_t i = 0; i < arrlenu(new_diags); i++) {
+        Diagnostic diag = new_diags[i];
+        diag.offset += begin;
+        arrput(ctx->diags, diag);
+    }
+    // an error exactly at old_end is a failed module in the region
+    // running into the next one
+    for (size_t i = 0; i < arrlenu(old_diags); i++) {
+        if (old_diags[i].offset > old_end) {
+            Diagnostic diag = old_diags[i];
+            diag.offset = diag.offset - edit.old_end + edit.new_end;
+            arrput(ctx->diags, diag);
+        }
+    }
+    arrfree(old_spans);
+    arrfree(new_spans);
+    arrfree(old_diags);
+    arrfree(new_diags);
+    free_tokens(&tl);
+    free_buffer(&region);
+}
+
+// Returns the AST_MODULE_BODY of module_def, parsing it first if it is
+// still an AST_LAZY_BODY. The parsed body replaces the lazy one in
+// module_def; its tokens stay in the Ast. If the body does not parse,
+// returns AST_NULL, leaves the lazy body in place and, unless error is
+// NULL, describes the syntax error in *error as parse_design() would.
+NodeId
+expand_module_body(Ast * ast, NodeId module_def, Diagnostic * error)
+{
+    NodeId lazy = ast_kid(ast, module_def, 2);
+    if (ast_type(ast, lazy) != AST_LAZY_BODY)
+        return lazy;
+
+    // a TokenList over the saved tokens; the parser needs no token text
+    uint32_t index = ast_value(ast, lazy);
+    TokenRange range = ast->lazy[index];
+    size_t n = range.end - range.begin;
+    static char no_text[1];
+    TokenList tl = { .base = no_text };
+    if (n) {
+        memcpy(arraddnptr(tl.types, n), &ast->lazy_types[range.begin], n * sizeof(*tl.types));
+        memcpy(arraddnptr(tl.values, n), &ast->lazy_values[range.begin], n * sizeof(*tl.values));
+        memcpy(arraddnptr(tl.offsets, n), &ast->lazy_offsets[range.begin], n * sizeof(*tl.offsets));
+    }
+    // EOF stands in for the endmodule that follows the body
+    arrput(tl.types, TOK_EOF);
+    arrput(tl.values, 0);
+    arrput(tl.offsets, n ? tl.offsets[n - 1] : 0);
+    memset(arraddnptr(tl.lens, n + 1), 0, (n + 1) * sizeof(*tl.lens));
+
+    ParseCtx ctx = init_parse_ctx(false, false, false);
+    ctx.ast = *ast;
+    ctx.toks = tl;
+    NodeId body = parse_module_body(&ctx);
+    if (peek_token(&ctx) != TOK_EOF)
+        body = AST_NULL;
+    if (body) {
+        ctx.ast.kids[ctx.ast.nodes[module_def].kids + 2] = body;
+    } else if (error) {
+        size_t pos = ctx.furthest > ctx.tok_pos ? ctx.furthest : ctx.tok_pos;
+        *error = (Diagnostic) {
+            .path = index < arrlenu(ast->lazy_paths) ? ast->lazy_paths[index] : NULL,
+            .offset = token_offset(&tl, pos < n ? pos : n),
+            .message = "syntax error",
+        };
+    }
+    *ast = ctx.ast;
+    ctx.ast = (Ast) {0};
+    ctx.toks = (TokenList) {0};
+    free_parse_ctx(&ctx);
+    free_tokens(&tl);
+    return body;
+}
+
+void
+free_parse_ctx(ParseCtx * ctx)
+{
+    free_ast(&ctx->ast);
+    free_symtab(&ctx->symtab);
+    arena_free(&ctx->arena);
+    arrfree(ctx->diags);
+    arrfree(ctx->spans);
+    arrfree(ctx->expr_stack);
+    free(ctx->net_slots);
+}
+
+static const char * backtrack_rule_names[] = {
+    [BT_BITRANGE]              = "parse_bitrange",
+    [BT_PORT_DECL]             = "parse_port_decl",
+    [BT_INDEX]                 = "parse_index",
+    [BT_LVALUE]                = "parse_lvalue",
+    [BT_EXPR]                  = "parse_expr",
+    [BT_UNARY]                 = "parse_unary",
+    [BT_PRIMARY]               = "parse_primary",
+    [BT_BLOCKING_NON_BLOCKING] = "parse_blocking_non_blocking",
+    [BT_ELSE]                  = "parse_else",
+    [BT_IF_STMT]               = "parse_if_stmt",
+    [BT_DELAY]                 = "parse_delay",
+    [BT_DPI]                   = "parse_dpi",
+    [BT_BLOCK]                 = "parse_block",
+    [BT_EMPTY_STMT]            = "parse_empty_stmt",
+    [BT_PROCEDURAL_STMT]       = "parse_procedural_stmt",
+    [BT_SENSITIVITY_LIST]      = "parse_sensitivity_list",
+    [BT_ALWAYS]                = "parse_always",
+    [BT_INITIAL]               = "parse_initial",
+    [BT_PORT_MAP]              = "parse_port_map",
+    [BT_INSTANTIATION]         = "parse_instantiation",
+    [BT_SIGNAL_DECL]           = "parse_signal_decl",
+    [BT_PARAM_DECL]            = "parse_param_decl",
+    [BT_ASSIGN]                = "parse_assign",
+    [BT_NETLIST_CELL]          = "parse_netlist_cell",
+    [BT_MODULE_DEF]            = "parse_module_def",
+};
+
+const char *
+backtrack_rule_name(BacktrackRule rule)
+{
+    return backtrack_rule_names[rule];
+}
+
+void
+add_parse_stats(ParseStats * dst, const ParseStats * src)
+{
+    add_phase_times(&dst->times, &src->times);
+    dst->tokens += src->tokens;
+    dst->nodes += src->nodes;
+    for (int i = 0; i < NUM_BT_RULES; i++) {
+        dst->backtracks[i] += src->backtracks[i];
+        dst->rewound[i] += src->rewound[i];
+    }
+}
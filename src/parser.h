@@ -0,0 +1,122 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+// Bump whenever a change to the tokenizer or parser changes the trees they
+// build for the same input; AST caches are keyed by it.
+#define PARSER_VERSION 2
+
+// A syntax error. offset is the byte offset of the offending token in the
+// parsed input; parse_design() adds the file and makes it file-relative.
+typedef struct {
+    const char * path;      // NULL straight from the parser
+    size_t offset;
+    const char * message;
+} Diagnostic;
+
+// Byte range of a module definition in the parsed input, from `module`
+// to the end of `endmodule`.
+typedef struct {
+    size_t begin;
+    size_t end;
+} Span;
+
+// A text edit as an editor reports it: bytes begin to old_end of the
+// previous input were replaced by what is now begin to new_end.
+typedef struct {
+    size_t begin;
+    size_t old_end;
+    size_t new_end;
+} Edit;
+
+// Rules that can fail after reading ahead, by the parse_* function they
+// are; the expression parser's frames count as parse_expr, parse_unary
+// and parse_primary.
+typedef enum {
+    BT_BITRANGE,
+    BT_PORT_DECL,
+    BT_INDEX,
+    BT_LVALUE,
+    BT_EXPR,
+    BT_UNARY,
+    BT_PRIMARY,
+    BT_BLOCKING_NON_BLOCKING,
+    BT_ELSE,
+    BT_IF_STMT,
+    BT_DELAY,
+    BT_DPI,
+    BT_BLOCK,
+    BT_EMPTY_STMT,
+    BT_PROCEDURAL_STMT,
+    BT_SENSITIVITY_LIST,
+    BT_ALWAYS,
+    BT_INITIAL,
+    BT_PORT_MAP,
+    BT_INSTANTIATION,
+    BT_SIGNAL_DECL,
+    BT_PARAM_DECL,
+    BT_ASSIGN,
+    BT_NETLIST_CELL,
+    BT_MODULE_DEF,
+    NUM_BT_RULES
+} BacktrackRule;
+
+// What --stats reports about parsing, added up over every parse with a
+// context. A backtrack is a failure that gives back more than the one
+// token the rule looked at.
+typedef struct {
+    PhaseTimes times;       // read, lex and parse
+    size_t tokens;          // lexed tokens parsed
+    size_t nodes;           // nodes built, failed alternatives included
+    size_t backtracks[NUM_BT_RULES];
+    size_t rewound[NUM_BT_RULES];   // tokens given back by the backtracks
+} ParseStats;
+
+// Streaming use of the parser. With a sink set, each module is handed
+// over as it is parsed: its header, then every item of its body, then its
+// end. An item's nodes are dropped as soon as item() returns, so besides
+// module headers the tree never holds more than the item being parsed. A
+// module that turns out to have an error gets no end(). Lazy and netlist
+// bodies and memoization are not used.
+typedef struct {
+    void (*begin)(void * user, Ast * ast, Symbol name, NodeId port_list);
+    void (*item)(void * user, Ast * ast, NodeId item);
+    void (*end)(void * user, Ast * ast, Symbol name);
+    void * user;
+} ItemSink;
+
+// Everything one parse needs. Nothing in the parser is global, so any
+// number of contexts can parse at the same time, one thread per context.
+typedef struct {
+    bool use_memo;
+    bool lazy;              // keep module bodies as tokens, see expand_module_body()
+    bool netlist;           // keep plain instances as a graph, see Netlist
+    const ItemSink * sink;  // NULL unless streaming items, see ItemSink
+    SymbolTable symtab;     // names interned while tokenizing for this context
+    Ast ast;                // result of the last parse
+    size_t memo_hits;
+    ParseStats stats;
+    Diagnostic * diags;     // stb_ds array, errors of the last parse
+    Span * spans;           // stb_ds array, one per module in ast.root
+
+    // private to the parser
+    TokenList toks;
+    size_t tok_pos;
+    size_t furthest;        // last token any rule has looked at
+    struct MemoEntry * memo; // NULL unless memoizing
+    struct ExprFrame * expr_stack; // stb_ds array, see parse_expr()
+    struct NetSlot * net_slots; // nets of the module being parsed, by name
+    uint32_t net_mask;
+    uint32_t net_slots_used;
+    Arena arena;            // per-parse scratch, currently the memo table
+} ParseCtx;
+
+ParseCtx init_parse_ctx(bool use_memo, bool lazy, bool netlist);
+void parse_tokens(ParseCtx * ctx, TokenList * tl);
+void parse_verilog(ParseCtx * ctx, Buffer input);
+void reparse_edit(ParseCtx * ctx, Buffer input, Edit edit);
+NodeId expand_module_body(Ast * ast, NodeId module_def, Diagnostic * error);
+void free_parse_ctx(ParseCtx * ctx);
+const char * backtrack_rule_name(BacktrackRule rule);
+void add_parse_stats(ParseStats * dst, const ParseStats * src);
+
+#endif /* PARSER_H */
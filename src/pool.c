@@ -0,0 +1,176 @@
+#include "alloc.h"
+#include "stb_ds.h"
+#include "common.h"
+#include "pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    Pool * pool;
+    int id;
+} WorkerArg;
+
+// Index of the worker running on this thread, -1 outside the pool.
+static __thread int current_worker = -1;
+static __thread Pool * current_pool;
+
+int
+num_cores()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+}
+
+static bool
+pop_back(WorkQueue * q, Task * task)
+{
+    bool found = false;
+    pthread_mutex_lock(&q->lock);
+    if (arrlenu(q->tasks) > q->head) {
+        *task = arrpop(q->tasks);
+        found = true;
+    }
+    if (arrlenu(q->tasks) == q->head) {
+        arrsetlen(q->tasks, 0);
+        q->head = 0;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+static bool
+steal_front(WorkQueue * q, Task * task)
+{
+    bool found = false;
+    pthread_mutex_lock(&q->lock);
+    if (arrlenu(q->tasks) > q->head) {
+        *task = q->tasks[q->head++];
+        found = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+static bool
+find_task(Pool * pool, int self, Task * task)
+{
+    if (pop_back(&pool->queues[self], task))
+        return true;
+    for (int i = 1; i < pool->nworkers; i++) {
+        if (steal_front(&pool->queues[(self + i) % pool->nworkers], task))
+            return true;
+    }
+    return false;
+}
+
+static void *
+worker_main(void * p)
+{
+    WorkerArg * arg = p;
+    Pool * pool = arg->pool;
+    int self = arg->id;
+    free(arg);
+    current_worker = self;
+    current_pool = pool;
+
+    while (1) {
+        Task task;
+        if (find_task(pool, self, &task)) {
+            pthread_mutex_lock(&pool->lock);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->lock);
+
+            task.fn(task.arg, self);
+
+            pthread_mutex_lock(&pool->lock);
+            if (--pool->pending == 0)
+                pthread_cond_broadcast(&pool->done_cv);
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stop && pool->queued == 0)
+            pthread_cond_wait(&pool->work_cv, &pool->lock);
+        bool stop = pool->stop && pool->queued == 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop)
+            break;
+    }
+    return NULL;
+}
+
+void
+init_pool(Pool * pool, int nworkers)
+{
+    *pool = (Pool) { .nworkers = nworkers > 0 ? nworkers : 1 };
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cv, NULL);
+    pthread_cond_init(&pool->done_cv, NULL);
+    pool->queues = calloc(pool->nworkers, sizeof(*pool->queues));
+    pool->threads = calloc(pool->nworkers, sizeof(*pool->threads));
+    if (pool->queues == NULL || pool->threads == NULL)
+        die("error: out of memory for thread pool\n");
+    for (int i = 0; i < pool->nworkers; i++)
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+    for (int i = 0; i < pool->nworkers; i++) {
+        WorkerArg * arg = malloc(sizeof(*arg));
+        if (arg == NULL)
+            die("error: out of memory for thread pool\n");
+        *arg = (WorkerArg) { pool, i };
+        int err = pthread_create(&pool->threads[i], NULL, worker_main, arg);
+        if (err)
+            die("error: cannot start worker thread: %s\n", strerror(err));
+    }
+}
+
+void
+pool_submit(Pool * pool, TaskFn fn, void * arg)
+{
+    int q = current_pool == pool ? current_worker : -1;
+    // counted before it is queued, so a worker that takes it at once
+    // never sees the counts go negative
+    pthread_mutex_lock(&pool->lock);
+    if (q < 0)
+        q = pool->next_queue++ % pool->nworkers;
+    pool->pending++;
+    pool->queued++;
+    pthread_cond_signal(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    WorkQueue * queue = &pool->queues[q];
+    pthread_mutex_lock(&queue->lock);
+    arrput(queue->tasks, ((Task) { fn, arg }));
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Blocks until every task submitted so far, and every task those
+// submitted in turn, has finished. Must not be called from a worker.
+void
+pool_wait(Pool * pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending)
+        pthread_cond_wait(&pool->done_cv, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void
+free_pool(Pool * pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->nworkers; i++)
+        pthread_join(pool->threads[i], NULL);
+    for (int i = 0; i < pool->nworkers; i++) {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+        arrfree(pool->queues[i].tasks);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cv);
+    pthread_cond_destroy(&pool->done_cv);
+    free(pool->queues);
+    free(pool->threads);
+}
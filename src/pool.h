@@ -0,0 +1,44 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+
+// Work-stealing thread pool. Every worker owns a deque of tasks: it pops
+// its own work from the back, and when that runs dry it steals from the
+// front of the other deques, so big and small tasks even out without a
+// central queue. Tasks submitted from a worker go onto that worker's
+// deque; tasks from any other thread are dealt out round-robin.
+
+typedef void (*TaskFn)(void * arg, int worker);
+
+typedef struct {
+    TaskFn fn;
+    void * arg;
+} Task;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Task * tasks;       // stb_ds array, live entries are tasks[head..]
+    size_t head;
+} WorkQueue;
+
+typedef struct Pool {
+    int nworkers;
+    pthread_t * threads;
+    WorkQueue * queues;
+    pthread_mutex_t lock;   // guards everything below
+    pthread_cond_t work_cv;
+    pthread_cond_t done_cv;
+    size_t queued;          // tasks sitting in some deque
+    size_t pending;         // tasks submitted but not yet finished
+    unsigned next_queue;
+    bool stop;
+} Pool;
+
+int num_cores();
+void init_pool(Pool * pool, int nworkers);
+void pool_submit(Pool * pool, TaskFn fn, void * arg);
+void pool_wait(Pool * pool);
+void free_pool(Pool * pool);
+
+#endif /* POOL_H */
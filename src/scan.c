@@ -0,0 +1,214 @@
+#include "common.h"
+#include "scan.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+typedef size_t (*ScanFn)(const char * p);
+
+enum {
+    CHAR_SPACE  = 1,
+    CHAR_IDENT  = 2,
+    CHAR_STRING = 4, // ordinary string contents
+};
+
+static uint8_t char_class[256];
+
+static void
+init_char_class()
+{
+    for (int c = 0; c < 256; c++) {
+        uint8_t cls = 0;
+        if (c == ' ' || (c >= '\t' && c <= '\r'))
+            cls |= CHAR_SPACE;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')
+            cls |= CHAR_IDENT;
+        if (c != '"' && c != '\\' && c != '\0')
+            cls |= CHAR_STRING;
+        char_class[c] = cls;
+    }
+}
+
+// '\0' is in none of the classes, so the padding ends every run
+static inline size_t
+scan_scalar(const char * p, uint8_t cls)
+{
+    const char * start = p;
+    while (char_class[(unsigned char) *p] & cls)
+        p++;
+    return p - start;
+}
+
+static size_t scan_whitespace_scalar(const char * p)  { return scan_scalar(p, CHAR_SPACE); }
+static size_t scan_ident_scalar(const char * p)       { return scan_scalar(p, CHAR_IDENT); }
+static size_t scan_string_scalar(const char * p)      { return scan_scalar(p, CHAR_STRING); }
+
+#ifdef SCAN_X86
+
+// The vector kernels compute a mask of the bytes that belong to the run and
+// stop at the first clear bit. Byte ranges [lo, hi] are tested with a
+// wrapping subtract followed by an unsigned saturating subtract, which is
+// zero exactly for the bytes inside the range.
+
+__attribute__((target("sse2"))) static inline __m128i
+in_range_sse2(__m128i v, char lo, char hi)
+{
+    __m128i x = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_subs_epu8(x, _mm_set1_epi8(hi - lo)), _mm_setzero_si128());
+}
+
+__attribute__((target("sse2"))) static inline __m128i
+whitespace_sse2(__m128i v)
+{
+    return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), in_range_sse2(v, '\t', '\r'));
+}
+
+__attribute__((target("sse2"))) static inline __m128i
+ident_sse2(__m128i v)
+{
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i m = _mm_or_si128(in_range_sse2(lower, 'a', 'z'), in_range_sse2(v, '0', '9'));
+    return _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+}
+
+__attribute__((target("sse2"))) static inline __m128i
+string_sse2(__m128i v)
+{
+    __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    return _mm_andnot_si128(stop, _mm_set1_epi8(-1));
+}
+
+#define SCAN_SSE2(name, classify) \
+    __attribute__((target("sse2"))) static size_t \
+    name(const char * p) \
+    { \
+        const char * start = p; \
+        while (1) { \
+            __m128i v = _mm_loadu_si128((const __m128i *) p); \
+            uint32_t mask = (uint32_t) _mm_movemask_epi8(classify(v)) ^ 0xffff; \
+            if (mask) \
+                return p - start + __builtin_ctz(mask); \
+            p += 16; \
+        } \
+    }
+
+SCAN_SSE2(scan_whitespace_sse2, whitespace_sse2)
+SCAN_SSE2(scan_ident_sse2,      ident_sse2)
+SCAN_SSE2(scan_string_sse2,     string_sse2)
+
+__attribute__((target("avx2"))) static inline __m256i
+in_range_avx2(__m256i v, char lo, char hi)
+{
+    __m256i x = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_subs_epu8(x, _mm256_set1_epi8(hi - lo)), _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+whitespace_avx2(__m256i v)
+{
+    return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), in_range_avx2(v, '\t', '\r'));
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+ident_avx2(__m256i v)
+{
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i m = _mm256_or_si256(in_range_avx2(lower, 'a', 'z'), in_range_avx2(v, '0', '9'));
+    return _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+string_avx2(__m256i v)
+{
+    __m256i stop = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+    return _mm256_andnot_si256(stop, _mm256_set1_epi8(-1));
+}
+
+#define SCAN_AVX2(name, classify) \
+    __attribute__((target("avx2"))) static size_t \
+    name(const char * p) \
+    { \
+        const char * start = p; \
+        while (1) { \
+            __m256i v = _mm256_loadu_si256((const __m256i *) p); \
+            uint32_t mask = ~(uint32_t) _mm256_movemask_epi8(classify(v)); \
+            if (mask) \
+                return p - start + __builtin_ctz(mask); \
+            p += 32; \
+        } \
+    }
+
+SCAN_AVX2(scan_whitespace_avx2, whitespace_avx2)
+SCAN_AVX2(scan_ident_avx2,      ident_avx2)
+SCAN_AVX2(scan_string_avx2,     string_avx2)
+
+#endif /* SCAN_X86 */
+
+static ScanFn scan_whitespace_fn = scan_whitespace_scalar;
+static ScanFn scan_ident_fn = scan_ident_scalar;
+static ScanFn scan_string_fn = scan_string_scalar;
+static const char * impl_name = "scalar";
+
+static void
+select_scan_kernels()
+{
+    init_char_class();
+#ifdef SCAN_X86
+    // VERILOG_PARSER_SCAN=scalar|sse2 caps the kernels used, for benchmarking
+    const char * cap = getenv("VERILOG_PARSER_SCAN");
+    bool allow_avx2 = !cap || !strcmp(cap, "avx2");
+    bool allow_sse2 = allow_avx2 || !strcmp(cap, "sse2");
+    __builtin_cpu_init();
+    if (allow_avx2 && __builtin_cpu_supports("avx2")) {
+        scan_whitespace_fn = scan_whitespace_avx2;
+        scan_ident_fn = scan_ident_avx2;
+        scan_string_fn = scan_string_avx2;
+        impl_name = "avx2";
+    } else if (allow_sse2 && __builtin_cpu_supports("sse2")) {
+        scan_whitespace_fn = scan_whitespace_sse2;
+        scan_ident_fn = scan_ident_sse2;
+        scan_string_fn = scan_string_sse2;
+        impl_name = "sse2";
+    }
+#endif
+}
+
+void
+init_scan()
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, select_scan_kernels);
+}
+
+const char *
+scan_impl_name()
+{
+    return impl_name;
+}
+
+size_t
+scan_whitespace(const char * p)
+{
+    return scan_whitespace_fn(p);
+}
+
+size_t
+scan_ident(const char * p)
+{
+    return scan_ident_fn(p);
+}
+
+size_t
+scan_string(const char * p)
+{
+    return scan_string_fn(p);
+}
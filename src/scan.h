@@ -0,0 +1,21 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+// Byte-run scanners used by the tokenizer's inner loops. Each returns the
+// number of bytes from p up to the first byte that ends the run. There is
+// no end pointer: input must be NUL-padded as described for Buffer in
+// common.h, since the scanners stop at the sentinel and may read up to 32
+// bytes past it. SSE2/AVX2 versions are picked at runtime by init_scan(),
+// with a scalar fallback for other CPUs.
+
+// ' ', '\t', '\n', '\v', '\f', '\r'
+size_t scan_whitespace(const char * p);
+// [A-Za-z0-9_]
+size_t scan_ident(const char * p);
+// everything up to '"', '\\' or '\0'
+size_t scan_string(const char * p);
+
+void init_scan();
+const char * scan_impl_name();
+
+#endif /* SCAN_H */
@@ -0,0 +1,78 @@
+#include "alloc.h"
+#include "stb_ds.h"
+#include "common.h"
+#include "split.h"
+#include <stdbool.h>
+#include <string.h>
+
+static bool
+is_ident_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+        || c == '_' || c == '$';
+}
+
+static bool
+is_space(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// The bytes that can start a comment, a string, an escaped identifier or
+// the keyword; everything else is skipped a byte at a time.
+static const bool interesting[256] = {
+    ['/'] = true, ['"'] = true, ['\\'] = true, ['m'] = true,
+};
+
+size_t *
+split_at_modules(Buffer input, size_t min_chunk)
+{
+    size_t * cuts = NULL;
+    arrput(cuts, 0);
+
+    const char * p = input.p;
+    size_t len = input.len;
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && !interesting[(unsigned char) p[i]])
+            i++;
+        if (i >= len)
+            break;
+
+        switch (p[i]) {
+        case '/':
+            if (p[i + 1] == '/') {
+                const char * nl = memchr(&p[i + 2], '\n', len - (i + 2));
+                i = nl ? (size_t) (nl - p + 1) : len;
+            } else if (p[i + 1] == '*') {
+                const char * q = &p[i + 2];
+                while ((q = memchr(q, '*', &p[len] - q)) && q[1] != '/')
+                    q++;
+                i = q ? (size_t) (q - p + 2) : len;
+            } else {
+                i++;
+            }
+            break;
+        case '"':
+            for (i++; i < len && p[i] != '"'; i++)
+                if (p[i] == '\\')
+                    i++;
+            i++;
+            break;
+        case '\\':
+            while (i < len && !is_space(p[i]))
+                i++;
+            break;
+        case 'm':
+            if (memcmp(&p[i], "module", 6) == 0 && !is_ident_char(p[i + 6])
+                    && (i == 0 || !(is_ident_char(p[i - 1]) || p[i - 1] == '`'))
+                    && i - arrlast(cuts) >= min_chunk)
+                arrput(cuts, i);
+            i++;
+            while (i < len && is_ident_char(p[i]))
+                i++;
+            break;
+        }
+    }
+    return cuts;
+}
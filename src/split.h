@@ -0,0 +1,12 @@
+#ifndef SPLIT_H
+#define SPLIT_H
+
+// Pre-scan for cutting one source file into pieces that parse on their
+// own. Returns an stb_ds array of byte offsets, the first of which is 0;
+// every other offset is the start of a top-level `module` keyword, so each
+// piece runs from one offset to the next (or to input.len) and holds whole
+// module definitions. Comments, strings and escaped identifiers are
+// skipped, and consecutive offsets are at least min_chunk bytes apart.
+size_t * split_at_modules(Buffer input, size_t min_chunk);
+
+#endif /* SPLIT_H */
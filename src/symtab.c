@@ -0,0 +1,112 @@
+#include "alloc.h"
+#include "stb_ds.h"
+#include "common.h"
+#include "symtab.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SYMTAB_MIN_SLOTS 1024
+
+static uint32_t
+hash_name(const char * s, size_t len)
+{
+    // 8 bytes per step; names are short, so this is mostly one or two rounds
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ len;
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, s, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+        s += 8;
+        len -= 8;
+    }
+    uint64_t w = 0;
+    memcpy(&w, s, len);
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 29;
+    return (uint32_t) h;
+}
+
+static void
+grow_slots(SymbolTable * symtab)
+{
+    SymbolSlot * old = symtab->slots;
+    size_t num_slots = old ? 2*arrlenu(old) : SYMTAB_MIN_SLOTS;
+    symtab->slots = NULL;
+    memset(arraddnptr(symtab->slots, num_slots), 0, num_slots*sizeof(*symtab->slots));
+    symtab->mask = num_slots - 1;
+    for (size_t j = 0; j < arrlenu(old); j++) {
+        if (!old[j].sym1)
+            continue;
+        uint32_t i = old[j].hash & symtab->mask;
+        while (symtab->slots[i].sym1)
+            i = (i + 1) & symtab->mask;
+        symtab->slots[i] = old[j];
+    }
+    arrfree(old);
+}
+
+Symbol
+intern(SymbolTable * symtab, const char * s, size_t len)
+{
+    if (symtab->slots == NULL)
+        grow_slots(symtab);
+
+    uint32_t hash = hash_name(s, len);
+    uint32_t i = hash & symtab->mask;
+    while (symtab->slots[i].sym1) {
+        SymbolSlot * slot = &symtab->slots[i];
+        if (slot->hash == hash && slot->entry.len == len &&
+            !memcmp(&symtab->strings[slot->entry.offset], s, len))
+            return slot->sym1 - 1;
+        i = (i + 1) & symtab->mask;
+    }
+
+    Symbol sym = arrlenu(symtab->entries);
+    SymbolEntry entry = { .offset = arrlenu(symtab->strings), .len = len };
+    arrput(symtab->entries, entry);
+    memcpy(arraddnptr(symtab->strings, len), s, len);
+    arrput(symtab->strings, '\0');
+    symtab->slots[i] = (SymbolSlot) { .hash = hash, .sym1 = sym + 1, .entry = entry };
+
+    // keep the load factor under 1/2
+    if (2*arrlenu(symtab->entries) > symtab->mask)
+        grow_slots(symtab);
+    return sym;
+}
+
+const char *
+sym_str(const SymbolTable * symtab, Symbol sym)
+{
+    return &symtab->strings[symtab->entries[sym].offset];
+}
+
+size_t
+sym_len(const SymbolTable * symtab, Symbol sym)
+{
+    return symtab->entries[sym].len;
+}
+
+size_t
+num_symbols(const SymbolTable * symtab)
+{
+    return arrlenu(symtab->entries);
+}
+
+void
+clear_symtab(SymbolTable * symtab)
+{
+    arrsetlen(symtab->strings, 0);
+    arrsetlen(symtab->entries, 0);
+    if (symtab->slots)
+        memset(symtab->slots, 0, arrlenu(symtab->slots)*sizeof(*symtab->slots));
+}
+
+void
+free_symtab(SymbolTable * symtab)
+{
+    arrfree(symtab->strings);
+    arrfree(symtab->entries);
+    arrfree(symtab->slots);
+    *symtab = (SymbolTable) {0};
+}
@@ -0,0 +1,37 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+// Identifier interning. Every distinct name gets a dense 32-bit Symbol, so
+// later passes compare names as integers. Names are stored once,
+// NUL-terminated, in the table's string store.
+
+typedef uint32_t Symbol;
+
+typedef struct {
+    uint32_t offset;    // start of the name in SymbolTable.strings
+    uint32_t len;
+} SymbolEntry;
+
+// Linear-probing slot. The hash and the location of the name are kept in
+// the slot itself, so a lookup touches one slot and one name at most.
+typedef struct {
+    uint32_t hash;
+    uint32_t sym1;      // symbol + 1, 0 = empty
+    SymbolEntry entry;
+} SymbolSlot;
+
+typedef struct {
+    char * strings;         // stb_ds array of NUL-terminated names
+    SymbolEntry * entries;  // indexed by Symbol
+    SymbolSlot * slots;
+    uint32_t mask;
+} SymbolTable;
+
+Symbol intern(SymbolTable * symtab, const char * s, size_t len);
+const char * sym_str(const SymbolTable * symtab, Symbol sym);
+size_t sym_len(const SymbolTable * symtab, Symbol sym);
+size_t num_symbols(const SymbolTable * symtab);
+void clear_symtab(SymbolTable * symtab);
+void free_symtab(SymbolTable * symtab);
+
+#endif /* SYMTAB_H */
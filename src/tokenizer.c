@@ -1,13 +1,19 @@
+#include "alloc.h"
+#include "stb_ds.h"
 #include "common.h"
+#include "symtab.h"
+#include "literal.h"
 #include "tokenizer.h"
+#include "scan.h"
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <stdlib.h>
 #include <stdbool.h>
-
-// TODO: literals e.g. 4'd7
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 
 // TODO: use X-macros for these
 #if 1
@@ -24,6 +30,18 @@ const char * token_strs[] = {
     ['['] = "[",
     [']'] = "]",
     ['|'] = "|",
+    ['&'] = "&",
+    ['^'] = "^",
+    ['~'] = "~",
+    ['!'] = "!",
+    ['+'] = "+",
+    ['-'] = "-",
+    ['*'] = "*",
+    ['/'] = "/",
+    ['%'] = "%",
+    ['<'] = "<",
+    ['>'] = ">",
+    ['?'] = "?",
     ['@'] = "@",
     ['\n'] = "\\n",
     [TOK_MODULE]        = "MODULE",
@@ -56,6 +74,14 @@ const char * token_strs[] = {
     [TOK_GTE]           = "GTE",
     [TOK_LSH]           = "LSH",
     [TOK_RSH]           = "RSH",
+    [TOK_ALSH]          = "ALSH",
+    [TOK_ARSH]          = "ARSH",
+    [TOK_CASE_EQ]       = "CASE_EQ",
+    [TOK_CASE_NEQ]      = "CASE_NEQ",
+    [TOK_POW]           = "POW",
+    [TOK_NAND]          = "NAND",
+    [TOK_NOR]           = "NOR",
+    [TOK_XNOR]          = "XNOR",
     [TOK_INVALID]       = "INVALID"
 };
 #endif
@@ -85,19 +111,121 @@ static Keyword keywords[] = {
     { "or",         2,  TOK_OR          },
 };
 
+// Keywords are recognized through a perfect hash: keyword_slots maps the
+// hash of every keyword to a distinct slot, so classifying an identifier
+// costs one hash, one slot load and at most one memcmp no matter how many
+// keywords there are. The seed and table size are searched for once, the
+// first time a tokenizer is created.
+
+#define KEYWORD_MAX_BITS 12
+
+static uint16_t keyword_slots[1 << KEYWORD_MAX_BITS]; // keyword index + 1
+static uint32_t keyword_mask;
+static uint32_t keyword_seed;
+static size_t keyword_max_len;
+static pthread_once_t keywords_once = PTHREAD_ONCE_INIT;
+
+static uint32_t
+keyword_hash(const char * s, size_t len, uint32_t seed)
+{
+    uint32_t h = seed ^ (uint32_t) len;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char) s[i]) * 0x01000193;
+    return h ^ (h >> 15);
+}
+
+static bool
+try_keyword_seed(uint32_t seed, uint32_t mask)
+{
+    memset(keyword_slots, 0, sizeof(keyword_slots));
+    for (size_t i = 0; i < NELEMS(keywords); i++) {
+        uint32_t slot = keyword_hash(keywords[i].str, keywords[i].len, seed) & mask;
+        if (keyword_slots[slot])
+            return false;
+        keyword_slots[slot] = i + 1;
+    }
+    return true;
+}
+
+static void
+build_keyword_table()
+{
+    keyword_max_len = 0;
+    for (size_t i = 0; i < NELEMS(keywords); i++) {
+        if (keywords[i].len > keyword_max_len)
+            keyword_max_len = keywords[i].len;
+    }
+
+    // start at a load factor of at most 1/4 and grow until a seed is found
+    int bits = 1;
+    while ((1u << bits) < 4*NELEMS(keywords))
+        bits++;
+    for (; bits <= KEYWORD_MAX_BITS; bits++) {
+        uint32_t mask = (1u << bits) - 1;
+        for (uint32_t seed = 1; seed <= 10000; seed++) {
+            if (try_keyword_seed(seed, mask)) {
+                keyword_seed = seed;
+                keyword_mask = mask;
+                return;
+            }
+        }
+    }
+    die("error: no perfect hash for keyword table\n");
+}
+
+// Safe to call from any number of threads; the table is built once.
+static void
+init_keywords()
+{
+    pthread_once(&keywords_once, build_keyword_table);
+}
+
+// The tokenizer's lookup; init_tokenizer() has built the table.
+static TokenType
+find_keyword(const char * s, size_t len)
+{
+    if (len > keyword_max_len)
+        return TOK_IDENT;
+    uint16_t slot = keyword_slots[keyword_hash(s, len, keyword_seed) & keyword_mask];
+    if (slot) {
+        const Keyword * kw = &keywords[slot - 1];
+        if (kw->len == len && !memcmp(kw->str, s, len))
+            return kw->tok_type;
+    }
+    return TOK_IDENT;
+}
+
+TokenType
+lookup_keyword(const char * s, size_t len)
+{
+    init_keywords();
+    return find_keyword(s, len);
+}
+
+// Reference implementation, kept for bench/bench_keywords.c
+TokenType
+lookup_keyword_linear(const char * s, size_t len)
+{
+    for (size_t i = 0; i < NELEMS(keywords); i++) {
+        if (len == keywords[i].len &&
+            !strncmp(s, keywords[i].str, len)) {
+            return keywords[i].tok_type;
+        }
+    }
+    return TOK_IDENT;
+}
+
+// No bounds checks: the buffer is NUL-padded (see common.h), and no caller
+// consumes more than two characters past the '\0' that ends the input.
 static char
 get_char(Tokenizer * tz)
 {
-    if (tz->buf_pos >= tz->buffer.len)
-        return '\0';
     return tz->buffer.p[tz->buf_pos++];
 }
 
 static char
 peek_char(Tokenizer * tz)
 {
-    if (tz->buf_pos >= tz->buffer.len)
-        return '\0';
     return tz->buffer.p[tz->buf_pos];
 }
 
@@ -116,65 +244,59 @@ get_ident_or_keyword(Tokenizer * tz)
 {
     Token tok = init_token(tz, TOK_IDENT);
 
-    while (1) {
-        char c = peek_char(tz);
-        if (!isalnum(c) && c != '_')
-            break;
-        get_char(tz);
-        tok.len++;
-    }
+    tok.len = scan_ident(tok.str);
+    tz->buf_pos += tok.len;
 
-    for (size_t i = 0; i < NELEMS(keywords); i++) {
-        if (tok.len == keywords[i].len &&
-            !strncmp(tok.str, keywords[i].str, tok.len)) {
-            tok.type = keywords[i].tok_type;
-            break;
-        }
-    }
+    tok.type = find_keyword(tok.str, tok.len);
 
     return tok;
 }
 
+// Numbers and based literals: 42, 1_000, 8'hff, 'sb1x0z, 16'D?.
+// Only the extent is found here; the value is decoded once by
+// decode_literal() when the token is appended to a TokenList.
 static Token
 get_literal(Tokenizer * tz)
 {
-    Token tok = init_token(tz, TOK_LITERAL);
+    Token tok = init_token(tz, TOK_NUMBER);
     char c = peek_char(tz);
-    if (isdigit(c)) {
-        while (1) {
-            get_char(tz);
-            tok.len++;
-            c = peek_char(tz);
-            if (c == '\'') {
-                tok.len++;
-                break;
-            } else if (!isdigit(c)) {
-                tok.type = TOK_NUMBER;
-                break;
-            }
-        }
-    } else if (c == '\'') {
+    while (isdigit(c) || c == '_') {
+        get_char(tz);
         tok.len++;
-    } else {
-        assert(0);
+        c = peek_char(tz);
     }
-    if (tok.type == TOK_NUMBER)
+    if (c != '\'')
         return tok;
-    assert(c == '\'');
-    get_char(tz); // discard '
+    tok.type = TOK_LITERAL;
+    get_char(tz); // '
+    tok.len++;
 
+    c = peek_char(tz);
+    if (c == 's' || c == 'S') {
+        get_char(tz);
+        tok.len++;
+    }
     c = get_char(tz);
     tok.len++;
     int base;
-    if      (c == 'b') base = 2;
-    else if (c == 'o') base = 8;
-    else if (c == 'd') base = 10;
-    else if (c == 'h') base = 16;
-    else assert(0); // TODO: error-handling
+    switch (c) {
+        case 'b': case 'B': base = 2;  break;
+        case 'o': case 'O': base = 8;  break;
+        case 'd': case 'D': base = 10; break;
+        case 'h': case 'H': base = 16; break;
+        default:
+            // no base, as in text being typed: leave c for the next token
+            tz->buf_pos--;
+            tok.len--;
+            tok.type = TOK_INVALID;
+            return tok;
+    }
 
     while (1) {
         c = peek_char(tz);
-        if (base == 2) {
+        if (c == '_' || c == 'x' || c == 'X' || c == 'z' || c == 'Z' || c == '?') {
+            // valid in every base
+        } else if (base == 2) {
             if (c != '0' && c != '1')
                 break;
         } else if (base == 8) {
@@ -214,53 +336,79 @@ get_string(Tokenizer * tz)
 {
     get_char(tz); // discard "
     Token tok = init_token(tz, TOK_STRING);
-    int prev_esc = 0;
     while (1) {
+        size_t n = scan_string(&tz->buffer.p[tz->buf_pos]);
+        tz->buf_pos += n;
+        tok.len += n;
         char c = get_char(tz);
-        if ((c == '"' && !prev_esc) || c == '\0')
+        if (c != '\\')
+            break; // closing " or end of input
+        // keep the escape and the character it escapes
+        tok.len++;
+        if (get_char(tz) == '\0')
             break;
-        prev_esc = c == '\\';
         tok.len++;
     }
     return tok;
 }
 
+// Operators of up to three characters. The padding after the input makes
+// it safe to look two characters ahead.
 static Token
 get_syntax(Tokenizer * tz)
 {
     Token tok = init_token(tz, TOK_STRING);
 
-    tok.type = get_char(tz);
-    TokenType tok_type = TOK_NONE;
+    char c0 = get_char(tz);
     char c = peek_char(tz);
-    switch (tok.type) {
+    char c2 = tz->buffer.p[tz->buf_pos + 1];
+    TokenType tok_type = TOK_NONE;
+    size_t len = 2;
+    switch (c0) {
         case '|':
             if      (c == '|') tok_type = TOK_LOGICAL_OR;
             break;
         case '&':
             if      (c == '&') tok_type = TOK_LOGICAL_AND;
             break;
+        case '^':
+            if      (c == '~') tok_type = TOK_XNOR;
+            break;
+        case '~':
+            if      (c == '&') tok_type = TOK_NAND;
+            else if (c == '|') tok_type = TOK_NOR;
+            else if (c == '^') tok_type = TOK_XNOR;
+            break;
+        case '*':
+            if      (c == '*') tok_type = TOK_POW;
+            break;
         case '<':
             if      (c == '=') tok_type = TOK_LTE;
-            else if (c == '<') tok_type = TOK_LSH;
+            else if (c == '<') tok_type = c2 == '<' ? TOK_ALSH : TOK_LSH;
             break;
         case '>':
             if      (c == '=') tok_type = TOK_GTE;
-            else if (c == '>') tok_type = TOK_RSH;
+            else if (c == '>') tok_type = c2 == '>' ? TOK_ARSH : TOK_RSH;
             break;
         case '=':
-            if      (c == '=') tok_type = TOK_EQ;
+            if      (c == '=') tok_type = c2 == '=' ? TOK_CASE_EQ : TOK_EQ;
+            break;
+        case '!':
+            if      (c == '=') tok_type = c2 == '=' ? TOK_CASE_NEQ : TOK_NEQ;
             break;
         //case '+':
         //    if      (c == '=') tok_type = TOK_PLUS_EQ;
         //    else if (c == '+') tok_type = TOK_INC;
         //    break;
     }
+    if (tok_type == TOK_ALSH || tok_type == TOK_ARSH || tok_type == TOK_CASE_EQ || tok_type == TOK_CASE_NEQ)
+        len = 3;
 
+    tok.type = c0;
     tok.len = 1;
     if (tok_type != TOK_NONE) {
-        get_char(tz);
-        tok.len++;
+        tz->buf_pos += len - 1;
+        tok.len = len;
         tok.type = tok_type;
     }
 
@@ -270,6 +418,8 @@ get_syntax(Tokenizer * tz)
 Tokenizer
 init_tokenizer(Buffer buffer)
 {
+    init_keywords();
+    init_scan();
     Tokenizer tz = {
         .buffer = buffer,
         .buf_pos = 0,
@@ -287,12 +437,34 @@ print_token(Token tok)
     fprintf(stderr, "%s '%s'\n", token_strs[tok.type], tmp);
 }
 
+// An unterminated comment runs to the end of the input.
+static void
+skip_whitespace_and_comments(Tokenizer * tz)
+{
+    const char * buf = tz->buffer.p;
+    const char * end = buf + tz->buffer.len;
+    while (1) {
+        tz->buf_pos += scan_whitespace(&buf[tz->buf_pos]);
+        const char * p = &buf[tz->buf_pos];
+        if (p[0] != '/' || (p[1] != '/' && p[1] != '*'))
+            return;
+        const char * q = p + 2;
+        if (p[1] == '/') {
+            q = memchr(q, '\n', end - q);
+        } else {
+            while ((q = memchr(q, '*', end - q)) && q[1] != '/')
+                q++;
+            if (q)
+                q++;
+        }
+        tz->buf_pos = q ? (size_t) (q + 1 - buf) : tz->buffer.len;
+    }
+}
+
 Token
 get_token(Tokenizer * tz)
 {
-    while (isspace(peek_char(tz))) {
-        get_char(tz);
-    }
+    skip_whitespace_and_comments(tz);
     Token tok;
     char c = peek_char(tz);
     if      (c == '\0')                 tok = (Token) { .type = TOK_EOF, .str = "", .len = 0 };
@@ -303,3 +475,239 @@ get_token(Tokenizer * tz)
     //print_token(tok);
     return tok;
 }
+
+static uint32_t
+token_value(Token tok, SymbolTable * symtab, LiteralTable * literals)
+{
+    if (tok.type == TOK_IDENT)
+        return intern(symtab, tok.str, tok.len);
+    if (tok.type == TOK_NUMBER || tok.type == TOK_LITERAL)
+        return decode_literal(literals, tok.str, tok.len);
+    return 0;
+}
+
+TokenList
+tokenize(Buffer buffer, SymbolTable * symtab)
+{
+    Tokenizer tz = init_tokenizer(buffer);
+    TokenList tl = { .base = buffer.p };
+
+    // rough guess to avoid most of the early regrowth
+    size_t guess = buffer.len/8 + 16;
+    arrsetcap(tl.types, guess);
+    arrsetcap(tl.offsets, guess);
+    arrsetcap(tl.lens, guess);
+    arrsetcap(tl.values, guess);
+
+    while (1) {
+        Token tok = get_token(&tz);
+        arrput(tl.types, (uint16_t) tok.type);
+        arrput(tl.offsets, tok.type == TOK_EOF ? buffer.len : (size_t) (tok.str - buffer.p));
+        arrput(tl.lens, (uint32_t) tok.len);
+        arrput(tl.values, token_value(tok, symtab, &tl.literals));
+        if (tok.type == TOK_EOF)
+            break;
+    }
+    return tl;
+}
+
+Token
+token_at(const TokenList * tl, size_t i)
+{
+    return (Token) {
+        .type = tl->types[i],
+        .str = tl->base + tl->offsets[i],
+        .len = tl->lens[i],
+        .value = tl->values[i]
+    };
+}
+
+// Byte offset of token i in the input it was lexed from.
+size_t
+token_offset(const TokenList * tl, size_t i)
+{
+    return tl->positions ? tl->positions[i] : tl->offsets[i];
+}
+
+size_t
+num_tokens(const TokenList * tl)
+{
+    return arrlenu(tl->types);
+}
+
+void
+free_tokens(TokenList * tl)
+{
+    arrfree(tl->types);
+    arrfree(tl->offsets);
+    arrfree(tl->lens);
+    arrfree(tl->values);
+    arrfree(tl->positions);
+    arrfree(tl->store);
+    free_literals(&tl->literals);
+}
+
+StreamTokenizer
+open_stream_tokenizer(int fd, size_t window_size)
+{
+    Buffer window = {
+        .p = malloc(window_size + BUFFER_PADDING),
+        .cap = window_size + BUFFER_PADDING,
+    };
+    if (window.p == NULL)
+        die("error: out of memory for stream window\n");
+    memset(window.p, 0, BUFFER_PADDING);
+    return (StreamTokenizer) {
+        .fd = fd,
+        .window_size = window_size,
+        .tz = init_tokenizer(window),
+    };
+}
+
+void
+close_stream_tokenizer(StreamTokenizer * st)
+{
+    free(st->tz.buffer.p);
+    st->tz.buffer.p = NULL;
+}
+
+// Discards everything before buf_pos and tops the window up from fd.
+// Returns false if the window is already full of unconsumed input.
+static bool
+refill_window(StreamTokenizer * st)
+{
+    Buffer * window = &st->tz.buffer;
+    size_t keep = window->len - st->tz.buf_pos;
+    memmove(window->p, window->p + st->tz.buf_pos, keep);
+    st->file_pos += st->tz.buf_pos;
+    st->tz.buf_pos = 0;
+    window->len = keep;
+    if (keep == st->window_size)
+        return false;
+
+    while (window->len < st->window_size) {
+        ssize_t n = read(st->fd, window->p + window->len, st->window_size - window->len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            die("error: read failed: %s\n", strerror(errno));
+        }
+        if (n == 0) {
+            st->eof = true;
+            break;
+        }
+        window->len += n;
+    }
+    memset(window->p + window->len, 0, BUFFER_PADDING);
+    return true;
+}
+
+// Skips the rest of a comment, '/' for a line comment or '*' for a block
+// comment. Returns false if it runs past the end of the window, having
+// consumed all of it but a '*' that may start the closing */.
+static bool
+skip_comment(Tokenizer * tz, char kind)
+{
+    const char * buf = tz->buffer.p;
+    const char * end = buf + tz->buffer.len;
+    const char * q = buf + tz->buf_pos;
+    if (kind == '/') {
+        q = memchr(q, '\n', end - q);
+    } else {
+        while ((q = memchr(q, '*', end - q)) && q[1] != '/')
+            q++;
+        if (q)
+            q++;
+    }
+    if (q) {
+        tz->buf_pos = q + 1 - buf;
+        return true;
+    }
+    tz->buf_pos = tz->buffer.len;
+    if (kind == '*' && tz->buf_pos > 0 && buf[tz->buf_pos - 1] == '*')
+        tz->buf_pos--;
+    return false;
+}
+
+// A token that runs into the end of the window might continue in the
+// next read, so it is lexed again after a refill. Only at the true end of
+// input is the sentinel allowed to end a token. Comments are not tokens:
+// they are skipped here, across as many refills as they take.
+static Token
+stream_get_token(StreamTokenizer * st)
+{
+    Tokenizer * tz = &st->tz;
+    char comment = 0;       // kind of the comment the window ended in
+    while (1) {
+        if (comment && skip_comment(tz, comment))
+            comment = 0;
+        while (!comment) {
+            tz->buf_pos += scan_whitespace(&tz->buffer.p[tz->buf_pos]);
+            const char * p = &tz->buffer.p[tz->buf_pos];
+            if (p[0] != '/' || (p[1] != '/' && p[1] != '*'))
+                break;
+            comment = p[1];
+            tz->buf_pos += 2;
+            if (skip_comment(tz, comment))
+                comment = 0;
+        }
+        // an unterminated comment runs to the end of the input
+        if (comment && st->eof) {
+            tz->buf_pos = tz->buffer.len;
+            comment = 0;
+        }
+        if (!comment) {
+            size_t start = tz->buf_pos;
+            if (start < tz->buffer.len || st->eof) {
+                Token tok = get_token(tz);
+                if (tz->buf_pos < tz->buffer.len || st->eof)
+                    return tok;
+            }
+            tz->buf_pos = start;
+        }
+        if (!refill_window(st))
+            die("error: token at offset %zu is longer than the %zu byte stream window\n",
+                st->file_pos, st->window_size);
+    }
+}
+
+bool
+stream_tokenize_module(StreamTokenizer * st, TokenList * tl, SymbolTable * symtab)
+{
+    arrsetlen(tl->types, 0);
+    arrsetlen(tl->offsets, 0);
+    arrsetlen(tl->lens, 0);
+    arrsetlen(tl->values, 0);
+    arrsetlen(tl->positions, 0);
+    arrsetlen(tl->store, 0);
+    clear_literals(&tl->literals);
+
+    while (1) {
+        Token tok = stream_get_token(st);
+        if (tok.type == TOK_EOF && arrlenu(tl->types) == 0)
+            break;
+        arrput(tl->types, (uint16_t) tok.type);
+        arrput(tl->offsets, arrlenu(tl->store));
+        arrput(tl->lens, (uint32_t) tok.len);
+        arrput(tl->values, token_value(tok, symtab, &tl->literals));
+        size_t pos = tok.type == TOK_EOF ? st->tz.buf_pos : (size_t) (tok.str - st->tz.buffer.p);
+        arrput(tl->positions, st->file_pos + pos);
+        memcpy(arraddnptr(tl->store, tok.len), tok.str, tok.len);
+        arrput(tl->store, '\0'); // keeps strtol() and friends inside the token
+        if (tok.type == TOK_EOF || tok.type == TOK_ENDMODULE)
+            break;
+    }
+    if (arrlenu(tl->types) == 0)
+        return false;
+
+    if (arrlast(tl->types) != TOK_EOF) {
+        arrput(tl->types, TOK_EOF);
+        arrput(tl->offsets, arrlenu(tl->store));
+        arrput(tl->lens, 0);
+        arrput(tl->values, 0);
+        arrput(tl->positions, st->file_pos + st->tz.buf_pos);
+        arrput(tl->store, '\0');
+    }
+    tl->base = tl->store;
+    return true;
+}
@@ -33,6 +33,14 @@ typedef enum {
     TOK_GTE,
     TOK_LSH,
     TOK_RSH,
+    TOK_ALSH,
+    TOK_ARSH,
+    TOK_CASE_EQ,
+    TOK_CASE_NEQ,
+    TOK_POW,
+    TOK_NAND,
+    TOK_NOR,
+    TOK_XNOR,
     TOK_INVALID
 } TokenType;
 
@@ -40,6 +48,7 @@ typedef struct {
     TokenType type;
     char * str;
     size_t len;
+    uint32_t value; // see TokenList.values
 } Token;
 
 typedef struct {
@@ -48,8 +57,50 @@ typedef struct {
     size_t buf_pos;
 } Tokenizer;
 
+// Whole-file token stream, stored as parallel stb_ds arrays so that the
+// parser only ever touches the fields it needs. Token i spans
+// base[offsets[i]..offsets[i]+lens[i]). The last token is always TOK_EOF.
+// base is either the input buffer or, for lists filled by a
+// StreamTokenizer, the list's own NUL-separated copy of the token text.
+// values holds the interned Symbol of each TOK_IDENT and the index into
+// literals of each TOK_NUMBER and TOK_LITERAL (0 for other tokens).
+// positions is NULL unless base is such a copy, in which case it holds the
+// byte offset of each token in the input; see token_offset().
+typedef struct {
+    uint16_t * types;
+    size_t * offsets;
+    uint32_t * lens;
+    uint32_t * values;
+    size_t * positions;
+    char * base;
+    char * store;
+    LiteralTable literals;
+} TokenList;
+
+// Lexes a file descriptor through a fixed-size window, so memory use does
+// not grow with the input: the window is refilled as tokens are consumed,
+// and stream_tokenize_module() copies each token into the TokenList it
+// fills before the window moves on.
+typedef struct {
+    int fd;
+    size_t window_size;
+    size_t file_pos; // file offset of tz.buffer.p[0]
+    bool eof;
+    Tokenizer tz;
+} StreamTokenizer;
+
 Tokenizer init_tokenizer(Buffer buffer);
+TokenType lookup_keyword(const char * s, size_t len);
+TokenType lookup_keyword_linear(const char * s, size_t len);
 void print_token(Token tok);
 Token get_token(Tokenizer * tz);
+TokenList tokenize(Buffer buffer, SymbolTable * symtab);
+Token token_at(const TokenList * tl, size_t i);
+size_t token_offset(const TokenList * tl, size_t i);
+size_t num_tokens(const TokenList * tl);
+void free_tokens(TokenList * tl);
+StreamTokenizer open_stream_tokenizer(int fd, size_t window_size);
+bool stream_tokenize_module(StreamTokenizer * st, TokenList * tl, SymbolTable * symtab);
+void close_stream_tokenizer(StreamTokenizer * st);
 
 #endif /* TOKENIZER_H */
@@ -0,0 +1,216 @@
+#define STB_DS_IMPLEMENTATION
+#include "alloc.h"
+#include "stb_ds.h"
+#include "common.h"
+#include "symtab.h"
+#include "literal.h"
+#include "arena.h"
+#include "ast.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "emit.h"
+#include "verilogparser.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// The library is the parser in streaming mode, see ItemSink: the stream
+// tokenizer hands it one module's tokens at a time and the sink turns
+// each item into an event before its nodes are dropped.
+
+#ifndef VP_WINDOW_SIZE
+#define VP_WINDOW_SIZE (1 << 20)
+#endif
+
+struct VpParser {
+    VpCallbacks cb;
+    void * user;
+    ParseCtx ctx;
+    ItemSink sink;
+    VpRange * dims;         // stb_ds arrays, reused from item to item
+    VpConnection * conns;
+};
+
+static const char *
+name_of(VpParser * vp, Symbol name)
+{
+    return sym_str(&vp->ctx.symtab, name);
+}
+
+// A BITRANGE, or AST_NULL for none.
+static const VpRange *
+get_range(Ast * ast, NodeId bitrange, VpRange * range)
+{
+    if (!bitrange)
+        return NULL;
+    range->msb = ast_number(ast, ast_kid(ast, bitrange, 0));
+    range->lsb = ast_number(ast, ast_kid(ast, bitrange, 1));
+    return range;
+}
+
+static void
+sink_begin(void * user, Ast * ast, Symbol name, NodeId port_list)
+{
+    VpParser * vp = user;
+    if (vp->cb.module_begin)
+        vp->cb.module_begin(vp->user, name_of(vp, name));
+    if (!vp->cb.port)
+        return;
+    for (uint32_t i = 0; i < ast_nkids(ast, port_list); i++) {
+        NodeId port = ast_kid(ast, port_list, i);
+        VpDirection dir = ast_type(ast, port) == AST_INPUT ? VP_INPUT : VP_OUTPUT;
+        VpRange range;
+        NodeId bitrange = ast_nkids(ast, port) ? ast_kid(ast, port, 0) : AST_NULL;
+        vp->cb.port(vp->user, dir, name_of(vp, ast_value(ast, port)), get_range(ast, bitrange, &range));
+    }
+}
+
+static void
+emit_declaration(VpParser * vp, Ast * ast, NodeId decl)
+{
+    arrsetlen(vp->dims, 0);
+    for (uint32_t i = 1; i < ast_nkids(ast, decl); i++) {
+        VpRange dim;
+        get_range(ast, ast_kid(ast, decl, i), &dim);
+        arrput(vp->dims, dim);
+    }
+    VpNetKind kind = ast_type(ast, decl) == AST_WIRE_DECL ? VP_WIRE : VP_REG;
+    VpRange range;
+    vp->cb.declaration(vp->user, kind, name_of(vp, ast_value(ast, decl)),
+                       get_range(ast, ast_kid(ast, decl, 0), &range), vp->dims, arrlenu(vp->dims));
+}
+
+static void
+emit_instance(VpParser * vp, Ast * ast, NodeId inst)
+{
+    NodeId port_maps = ast_kid(ast, inst, 2);
+    arrsetlen(vp->conns, 0);
+    for (uint32_t i = 0; i < ast_nkids(ast, port_maps); i++) {
+        NodeId port_map = ast_kid(ast, port_maps, i);
+        NodeId expr = ast_kid(ast, port_map, 1);
+        VpConnection conn = {
+            .pin = name_of(vp, ast_value(ast, ast_kid(ast, port_map, 0))),
+            .bit = VP_WHOLE,
+            .expr = expr,
+        };
+        if (ast_type(ast, expr) == AST_IDENT) {
+            conn.net = name_of(vp, ast_value(ast, expr));
+        } else if (ast_type(ast, expr) == AST_INDEX
+                   && ast_type(ast, ast_kid(ast, expr, 0)) == AST_IDENT
+                   && ast_type(ast, ast_kid(ast, expr, 1)) == AST_NUMBER) {
+            conn.net = name_of(vp, ast_value(ast, ast_kid(ast, expr, 0)));
+            conn.bit = ast_number(ast, ast_kid(ast, expr, 1));
+        }
+        arrput(vp->conns, conn);
+    }
+    vp->cb.instance(vp->user, name_of(vp, ast_value(ast, ast_kid(ast, inst, 0))),
+                    name_of(vp, ast_value(ast, ast_kid(ast, inst, 1))), vp->conns, arrlenu(vp->conns));
+}
+
+static void
+sink_item(void * user, Ast * ast, NodeId item)
+{
+    VpParser * vp = user;
+    switch (ast_type(ast, item)) {
+        case AST_WIRE_DECL:
+        case AST_REG_DECL:
+            if (vp->cb.declaration)
+                emit_declaration(vp, ast, item);
+            break;
+        case AST_CONT_ASSIGN:
+            if (vp->cb.assignment)
+                vp->cb.assignment(vp->user, name_of(vp, ast_value(ast, ast_kid(ast, item, 0))),
+                                  ast_kid(ast, item, 1));
+            break;
+        case AST_INSTANTIATION:
+            if (vp->cb.instance)
+                emit_instance(vp, ast, item);
+            break;
+        default:
+            break;
+    }
+}
+
+static void
+sink_end(void * user, Ast * ast, Symbol name)
+{
+    (void) ast;
+    VpParser * vp = user;
+    if (vp->cb.module_end)
+        vp->cb.module_end(vp->user, name_of(vp, name));
+}
+
+VpParser *
+vp_open(const VpCallbacks * callbacks, void * user)
+{
+    VpParser * vp = calloc(1, sizeof(*vp));
+    if (!vp)
+        return NULL;
+    vp->cb = *callbacks;
+    vp->user = user;
+    vp->sink = (ItemSink) {
+        .begin = sink_begin,
+        .item = sink_item,
+        .end = sink_end,
+        .user = vp,
+    };
+    vp->ctx = init_parse_ctx(false, false, false);
+    vp->ctx.sink = &vp->sink;
+    return vp;
+}
+
+// Parses everything readable from fd, which stays open. path is only
+// passed on to the error callback. Returns the number of syntax errors.
+int
+vp_parse_fd(VpParser * vp, int fd, const char * path)
+{
+    ParseCtx * ctx = &vp->ctx;
+    StreamTokenizer st = open_stream_tokenizer(fd, VP_WINDOW_SIZE);
+    TokenList module_toks = {0};
+    int errors = 0;
+    while (stream_tokenize_module(&st, &module_toks, &ctx->symtab)) {
+        parse_tokens(ctx, &module_toks);
+        for (size_t i = 0; i < arrlenu(ctx->diags); i++) {
+            if (vp->cb.error)
+                vp->cb.error(vp->user, path, ctx->diags[i].offset, ctx->diags[i].message);
+            errors++;
+        }
+        clear_symtab(&ctx->symtab);
+    }
+    free_tokens(&module_toks);
+    close_stream_tokenizer(&st);
+    return errors;
+}
+
+// As vp_parse_fd(), or -1 with errno set if path cannot be opened.
+int
+vp_parse_file(VpParser * vp, const char * path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    int errors = vp_parse_fd(vp, fd, path);
+    close(fd);
+    return errors;
+}
+
+// Formats expr as Verilog like snprintf(): writes as much as fits in
+// cap - 1 bytes and a NUL to out, and returns the full length. Only valid
+// inside the callback that was passed expr.
+size_t
+vp_expr_text(VpParser * vp, VpExpr expr, char * out, size_t cap)
+{
+    return format_expr(&vp->ctx.ast, &vp->ctx.symtab, expr, out, cap);
+}
+
+void
+vp_close(VpParser * vp)
+{
+    if (!vp)
+        return;
+    free_parse_ctx(&vp->ctx);
+    arrfree(vp->dims);
+    arrfree(vp->conns);
+    free(vp);
+}
@@ -0,0 +1,78 @@
+#ifndef VERILOGPARSER_H
+#define VERILOGPARSER_H
+
+// Public interface of libverilogparser: a streaming, callback-driven
+// reader of Verilog. Files are read through a fixed-size window and every
+// item is reported as soon as it is parsed and then forgotten, so memory
+// stays flat however big the design is, and no tree of it is ever built.
+//
+// Events come in source order:
+//
+//     module_begin, port..., then declaration, assignment and instance
+//     in any order, then module_end
+//
+// always and initial blocks are parsed but not reported. A module with a
+// syntax error gets an error event and no module_end. Every pointer passed
+// to a callback, and every VpExpr, is only valid until it returns; copy
+// what you need to keep. Any callback may be NULL.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VP_API __attribute__((visibility("default")))
+
+typedef struct VpParser VpParser;
+
+typedef enum {
+    VP_INPUT,
+    VP_OUTPUT,
+} VpDirection;
+
+typedef enum {
+    VP_WIRE,
+    VP_REG,
+} VpNetKind;
+
+// [msb:lsb]
+typedef struct {
+    int64_t msb;
+    int64_t lsb;
+} VpRange;
+
+// An expression in the item being reported, see vp_expr_text().
+typedef uint32_t VpExpr;
+
+#define VP_WHOLE (-1)
+
+// .pin(expr) of an instance. If expr is a plain net, or a constant bit of
+// one, net names it and bit is the bit or VP_WHOLE; otherwise net is NULL.
+typedef struct {
+    const char * pin;
+    const char * net;
+    int64_t bit;
+    VpExpr expr;
+} VpConnection;
+
+typedef struct {
+    void (*module_begin)(void * user, const char * name);
+    // range is NULL for a one bit port
+    void (*port)(void * user, VpDirection dir, const char * name, const VpRange * range);
+    // range as for port; dims are the unpacked dimensions, e.g. of a memory
+    void (*declaration)(void * user, VpNetKind kind, const char * name, const VpRange * range,
+                        const VpRange * dims, size_t ndims);
+    // assign lhs = rhs;
+    void (*assignment)(void * user, const char * lhs, VpExpr rhs);
+    void (*instance)(void * user, const char * module, const char * name,
+                     const VpConnection * conns, size_t nconns);
+    void (*module_end)(void * user, const char * name);
+    // offset is the byte offset of the offending token in path
+    void (*error)(void * user, const char * path, size_t offset, const char * message);
+} VpCallbacks;
+
+VP_API VpParser * vp_open(const VpCallbacks * callbacks, void * user);
+VP_API int vp_parse_fd(VpParser * vp, int fd, const char * path);
+VP_API int vp_parse_file(VpParser * vp, const char * path);
+VP_API size_t vp_expr_text(VpParser * vp, VpExpr expr, char * out, size_t cap);
+VP_API void vp_close(VpParser * vp);
+
+#endif /* VERILOGPARSER_H */